@@ -0,0 +1,211 @@
+#include "ackermann.h"
+
+// The vector backends are x86 only; elsewhere everything runs scalar.
+#if defined(__x86_64__) || defined(__i386__)
+#define ACKERMANN_VECTOR 1
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+#include "vm.h"
+
+static constexpr uint16_t kMask = kMaxInt - 1;
+static constexpr uint16_t kFirstTable = 3;
+
+uint16_t Ackermann::operator()(uint16_t m, uint16_t n, uint16_t r7) {
+    r7_ = r7;
+    if (m >= kFirstTable && rows_.size() <= size_t(m - kFirstTable)) {
+        rows_.resize(m - kFirstTable + 1, std::vector<uint16_t>(kMaxInt));
+        filled_.resize(rows_.size());
+    }
+    std::fill(filled_.begin(), filled_.end(), 0);
+    return get(m, n);
+}
+
+uint16_t Ackermann::get(uint16_t m, uint16_t n) {
+    uint32_t step = r7_ + 1;
+    switch (m) {
+        case 0: return (n + 1) & kMask;
+        case 1: return (n + step) & kMask;
+        case 2: return ((n + 2) * step - 1) & kMask;
+    }
+
+    auto* row = rows_[m - kFirstTable].data();
+    auto& filled = filled_[m - kFirstTable];
+    if (filled > n) return row[n];
+    if (filled == 0) row[filled++] = get(m - 1, r7_);
+    if (m == kFirstTable) {
+        // level 2 inline: f(2, x) = x * step + (2 * step - 1)
+        uint32_t base = 2 * step - 1;
+        for (; filled <= n; filled++) {
+            row[filled] = (row[filled - 1] * step + base) & kMask;
+        }
+    } else {
+        for (; filled <= n; filled++) row[filled] = get(m - 1, row[filled - 1]);
+    }
+    return row[n];
+}
+
+const char* to_string(AckermannBackend backend) {
+    switch (backend) {
+        case AckermannBackend::Scalar: return "scalar";
+        case AckermannBackend::Avx2: return "avx2";
+        case AckermannBackend::Avx512: return "avx512";
+    }
+}
+
+bool parse_backend(std::string_view name, AckermannBackend& backend) {
+    for (auto b : {AckermannBackend::Scalar, AckermannBackend::Avx2,
+                   AckermannBackend::Avx512}) {
+        if (name == to_string(b)) {
+            backend = b;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool supported(AckermannBackend backend) {
+    switch (backend) {
+        case AckermannBackend::Scalar: return true;
+#ifdef ACKERMANN_VECTOR
+        case AckermannBackend::Avx2: return __builtin_cpu_supports("avx2");
+        case AckermannBackend::Avx512:
+            return __builtin_cpu_supports("avx512bw");
+#else
+        case AckermannBackend::Avx2:
+        case AckermannBackend::Avx512: return false;
+#endif
+    }
+}
+
+AckermannBackend best_backend() {
+    if (supported(AckermannBackend::Avx512)) return AckermannBackend::Avx512;
+    if (supported(AckermannBackend::Avx2)) return AckermannBackend::Avx2;
+    return AckermannBackend::Scalar;
+}
+
+#ifdef ACKERMANN_VECTOR
+namespace {
+
+// Independent vectors stepped together, to hide the multiply latency of
+// the recurrence.
+static constexpr int kVectors = 4;
+
+static uint16_t max_index(const uint16_t* idx, size_t n) {
+    uint16_t last = 0;
+    for (size_t i = 0; i < n; i++) {
+        last = std::max<uint16_t>(last, idx[i] & kMask);
+    }
+    return last;
+}
+
+// Lanes run the recurrence modulo 2^16, which agrees with the routine's
+// arithmetic modulo 2^15 once the result is masked.
+__attribute__((target("avx2"))) void sweep_avx2(const uint16_t* r7,
+                                                const uint16_t* idx,
+                                                uint16_t* out) {
+    static constexpr int kLanes = 16;
+    __m256i step[kVectors], base[kVectors], x[kVectors], want[kVectors],
+        got[kVectors];
+    auto one = _mm256_set1_epi16(1);
+    for (int v = 0; v < kVectors; v++) {
+        auto k = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(r7 + v * kLanes));
+        step[v] = _mm256_add_epi16(k, one);
+        base[v] = _mm256_sub_epi16(_mm256_add_epi16(step[v], step[v]), one);
+        // f(3, 0) = f(2, r7) = (r7 + 2) * (r7 + 1) - 1
+        x[v] = _mm256_sub_epi16(
+            _mm256_mullo_epi16(_mm256_add_epi16(step[v], one), step[v]), one);
+        want[v] = _mm256_and_si256(
+            _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(idx + v * kLanes)),
+            _mm256_set1_epi16(kMask));
+        got[v] = _mm256_setzero_si256();
+    }
+    auto last = max_index(idx, kVectors * kLanes);
+    auto i = _mm256_setzero_si256();
+    for (uint32_t n = 0; n <= last; n++) {
+        for (int v = 0; v < kVectors; v++) {
+            auto hit = _mm256_cmpeq_epi16(i, want[v]);
+            got[v] = _mm256_or_si256(got[v], _mm256_and_si256(hit, x[v]));
+            x[v] = _mm256_add_epi16(_mm256_mullo_epi16(x[v], step[v]),
+                                    base[v]);
+        }
+        i = _mm256_add_epi16(i, one);
+    }
+    for (int v = 0; v < kVectors; v++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + v * kLanes),
+                            got[v]);
+    }
+}
+
+__attribute__((target("avx512bw"))) void sweep_avx512(const uint16_t* r7,
+                                                      const uint16_t* idx,
+                                                      uint16_t* out) {
+    static constexpr int kLanes = 32;
+    __m512i step[kVectors], base[kVectors], x[kVectors], want[kVectors],
+        got[kVectors];
+    auto one = _mm512_set1_epi16(1);
+    for (int v = 0; v < kVectors; v++) {
+        auto k = _mm512_loadu_si512(r7 + v * kLanes);
+        step[v] = _mm512_add_epi16(k, one);
+        base[v] = _mm512_sub_epi16(_mm512_add_epi16(step[v], step[v]), one);
+        x[v] = _mm512_sub_epi16(
+            _mm512_mullo_epi16(_mm512_add_epi16(step[v], one), step[v]), one);
+        want[v] = _mm512_and_si512(_mm512_loadu_si512(idx + v * kLanes),
+                                   _mm512_set1_epi16(kMask));
+        got[v] = _mm512_setzero_si512();
+    }
+    auto last = max_index(idx, kVectors * kLanes);
+    auto i = _mm512_setzero_si512();
+    for (uint32_t n = 0; n <= last; n++) {
+        for (int v = 0; v < kVectors; v++) {
+            auto hit = _mm512_cmpeq_epi16_mask(i, want[v]);
+            got[v] = _mm512_mask_mov_epi16(got[v], hit, x[v]);
+            x[v] = _mm512_add_epi16(_mm512_mullo_epi16(x[v], step[v]),
+                                    base[v]);
+        }
+        i = _mm512_add_epi16(i, one);
+    }
+    for (int v = 0; v < kVectors; v++) {
+        _mm512_storeu_si512(out + v * kLanes, got[v]);
+    }
+}
+
+// f(4, 1) = f(3, f(4, 0)) = f(3, f(3, r7)): two sweeps of level 3, the
+// first sampled at r7 and the second at the first's result.
+template <int kLanes, typename Sweep>
+void vector_4_1(Sweep sweep, const uint16_t* r7, uint16_t* out, size_t n) {
+    static constexpr size_t kBatch = kVectors * kLanes;
+    uint16_t k[kBatch], mid[kBatch], res[kBatch];
+    for (size_t start = 0; start < n; start += kBatch) {
+        auto count = std::min(kBatch, n - start);
+        std::copy(r7 + start, r7 + start + count, k);
+        std::fill(k + count, k + kBatch, 0);
+        sweep(k, k, mid);
+        sweep(k, mid, res);
+        for (size_t i = 0; i < count; i++) out[start + i] = res[i] & kMask;
+    }
+}
+
+}  // namespace
+#endif  // ACKERMANN_VECTOR
+
+void ackermann_4_1(AckermannBackend backend, const uint16_t* r7,
+                   uint16_t* out, size_t n) {
+#ifdef ACKERMANN_VECTOR
+    switch (backend) {
+        case AckermannBackend::Scalar: break;
+        case AckermannBackend::Avx2:
+            vector_4_1<16>(sweep_avx2, r7, out, n);
+            return;
+        case AckermannBackend::Avx512:
+            vector_4_1<32>(sweep_avx512, r7, out, n);
+            return;
+    }
+#endif
+    Ackermann eval;
+    for (size_t i = 0; i < n; i++) out[i] = eval(4, 1, r7[i]);
+}
@@ -0,0 +1,57 @@
+#ifndef ACKERMANN_H_
+#define ACKERMANN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Evaluates the teleporter confirmation routine at address 6027, which is
+// the Ackermann-like function
+//
+//     f(0, n) = n + 1
+//     f(m, 0) = f(m - 1, r7)
+//     f(m, n) = f(m - 1, f(m, n - 1))
+//
+// modulo 32768, without recursion. Levels 0 to 2 have closed forms:
+//
+//     f(1, n) = n + r7 + 1
+//     f(2, n) = (n + 2) * (r7 + 1) - 1
+//
+// and every level above is tabulated from the one below in a single pass
+// over n. A table is only filled as far as the level above reads it, so
+// f(4, 1) costs at most one 32K-entry sweep for level 3.
+class Ackermann {
+public:
+    uint16_t operator()(uint16_t m, uint16_t n, uint16_t r7);
+
+private:
+    uint16_t get(uint16_t m, uint16_t n);
+
+    uint16_t r7_ = 0;
+    std::vector<std::vector<uint16_t>> rows_;  // levels 3 and up
+    std::vector<uint32_t> filled_;
+};
+
+// Ways of evaluating f(4, 1), the value the teleporter checks, for a batch
+// of r7 candidates. The vector backends run one candidate per 16-bit lane
+// and need no tables: level 2 is a closed form, so level 3 is the affine
+// recurrence x' = x * (r7 + 1) + 2 * r7 + 1, stepped in every lane at once
+// and sampled where each lane's index comes up.
+enum class AckermannBackend {
+    Scalar,
+    Avx2,    // 16 lanes
+    Avx512,  // 32 lanes, needs AVX-512BW
+};
+
+const char* to_string(AckermannBackend backend);
+bool parse_backend(std::string_view name, AckermannBackend& backend);
+// Whether this cpu runs |backend|. The vector backends are x86 only.
+bool supported(AckermannBackend backend);
+AckermannBackend best_backend();
+
+// Sets out[i] = f(4, 1) for r7[i], i < n.
+void ackermann_4_1(AckermannBackend backend, const uint16_t* r7,
+                   uint16_t* out, size_t n);
+
+#endif  // ACKERMANN_H_
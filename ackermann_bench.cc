@@ -0,0 +1,56 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "ackermann.h"
+#include "teleporter.h"
+
+// Compares the recursive and iterative evaluators of the confirmation
+// routine and the batch backends on the same r7 candidates.
+
+template <typename F>
+static double time_per_call(int n, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) f(i);
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    return d.count() / n;
+}
+
+int main(int argc, char* argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 200;
+    Ackermann eval;
+    for (int r7 = 0; r7 < n; r7++) {
+        if (eval(4, 1, r7) != verify_reg8(r7)) {
+            fprintf(stderr, "mismatch at r7=%d\n", r7);
+            return 1;
+        }
+    }
+    double recursive = time_per_call(n, [](int r7) { verify_reg8(r7); });
+    double iterative = time_per_call(n, [&](int r7) { eval(4, 1, r7); });
+    printf("recursive: %10.2f us/candidate\n", recursive * 1e6);
+    printf("iterative: %10.2f us/candidate\n", iterative * 1e6);
+    printf("speedup:   %10.1fx\n", recursive / iterative);
+
+    std::vector<uint16_t> r7(n), out(n);
+    for (int i = 0; i < n; i++) r7[i] = i;
+    for (auto backend : {AckermannBackend::Scalar, AckermannBackend::Avx2,
+                         AckermannBackend::Avx512}) {
+        if (!supported(backend)) continue;
+        auto start = std::chrono::steady_clock::now();
+        ackermann_4_1(backend, r7.data(), out.data(), n);
+        std::chrono::duration<double> d =
+            std::chrono::steady_clock::now() - start;
+        for (int i = 0; i < n; i++) {
+            if (out[i] != verify_reg8(i)) {
+                fprintf(stderr, "%s mismatch at r7=%d\n", to_string(backend),
+                        i);
+                return 1;
+            }
+        }
+        printf("%-9s  %10.2f us/candidate\n", to_string(backend),
+               d.count() / n * 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,275 @@
+#include "cfg.h"
+
+namespace {
+
+// How far a literal is followed before it is accepted as code.
+static constexpr int kPlausibleRun = 64;
+
+bool ends_block(Opcode op) {
+    switch (op) {
+        case Opcode::Halt:
+        case Opcode::Jmp:
+        case Opcode::Jt:
+        case Opcode::Jf:
+        case Opcode::Call:
+        case Opcode::Ret: return true;
+        default: return false;
+    }
+}
+
+bool falls_through(Opcode op) {
+    return op != Opcode::Halt && op != Opcode::Jmp && op != Opcode::Ret;
+}
+
+// Whether straight-line decoding from |addr| reaches the end of a block
+// without hitting an invalid instruction. Zeroed buffers decode as Halt,
+// so a run containing one is taken to be data.
+bool plausible(const std::vector<uint16_t>& mem, uint16_t addr) {
+    for (int i = 0; i < kPlausibleRun; i++) {
+        auto instr = decode_at(mem, addr);
+        if (!instr.has_value() || instr->op == Opcode::Halt) return false;
+        if (ends_block(instr->op)) return true;
+        addr += instr->size();
+    }
+    return false;
+}
+
+}  // namespace
+
+std::optional<Instr> decode_at(const std::vector<uint16_t>& mem,
+                               uint16_t addr) {
+    if (addr >= mem.size() || !is_opcode(mem[addr])) return std::nullopt;
+    Instr instr{static_cast<Opcode>(mem[addr]), {0, 0, 0}};
+    if (addr + instr.size() > mem.size()) return std::nullopt;
+    for (int i = 0; i < arity(instr.op); i++) {
+        auto val = mem[addr + 1 + i];
+        if (val >= kMaxInt + kNumReg) return std::nullopt;
+        instr.args[i] = val;
+    }
+    if (writes_first_arg(instr.op) && instr.args[0] < kMaxInt) {
+        return std::nullopt;
+    }
+    return instr;
+}
+
+Cfg recover_cfg(const std::vector<uint16_t>& mem,
+                const std::vector<uint16_t>& entries) {
+    Cfg cfg;
+    cfg.code.resize(mem.size());
+    std::vector<uint16_t> work(entries.begin(), entries.end());
+    std::set<uint16_t> literals;
+    std::set<uint16_t> roots(entries.begin(), entries.end());
+    for (auto entry : entries) cfg.leaders.insert(entry);
+
+    auto target = [&](uint16_t addr) {
+        cfg.leaders.insert(addr);
+        work.push_back(addr);
+    };
+
+    while (true) {
+        while (!work.empty()) {
+            auto addr = work.back();
+            work.pop_back();
+            while (!cfg.instrs.count(addr)) {
+                auto instr = decode_at(mem, addr);
+                if (!instr.has_value()) {
+                    // not code after all, so nothing may jump here natively
+                    cfg.leaders.erase(addr);
+                    break;
+                }
+                cfg.instrs[addr] = *instr;
+                for (int i = 0; i < instr->size(); i++) {
+                    cfg.code[addr + i] = true;
+                }
+
+                auto op = instr->op;
+                auto a = instr->args[0], b = instr->args[1];
+                if ((op == Opcode::Jmp || op == Opcode::Call) && a < kMaxInt) {
+                    target(a);
+                }
+                if (op == Opcode::Call && a < kMaxInt) roots.insert(a);
+                if ((op == Opcode::Jt || op == Opcode::Jf) && b < kMaxInt) {
+                    target(b);
+                }
+                if ((op == Opcode::Set && b < kMaxInt) ||
+                    (op == Opcode::Push && a < kMaxInt)) {
+                    literals.insert(op == Opcode::Set ? b : a);
+                }
+                if (!falls_through(op)) break;
+                addr += instr->size();
+                if (ends_block(op) || cfg.instrs.count(addr)) {
+                    target(addr);
+                    break;
+                }
+            }
+        }
+
+        for (auto lit : literals) {
+            if (!cfg.instrs.count(lit) && plausible(mem, lit)) {
+                target(lit);
+                roots.insert(lit);
+            }
+        }
+        literals.clear();
+        if (work.empty()) break;
+    }
+
+    for (auto root : roots) {
+        if (!cfg.is_leader(root)) continue;
+        auto& blocks = cfg.functions[root];
+        std::vector<uint16_t> todo = {root};
+        while (!todo.empty()) {
+            auto leader = todo.back();
+            todo.pop_back();
+            if (!blocks.insert(leader).second) continue;
+            for (auto next : cfg.successors(leader)) todo.push_back(next);
+        }
+    }
+    return cfg;
+}
+
+std::vector<uint16_t> Cfg::block(uint16_t leader) const {
+    std::vector<uint16_t> addrs;
+    auto addr = leader;
+    for (auto it = instrs.find(addr); it != instrs.end();
+         it = instrs.find(addr)) {
+        if (addr != leader && is_leader(addr)) break;
+        addrs.push_back(addr);
+        if (ends_block(it->second.op)) break;
+        addr += it->second.size();
+    }
+    return addrs;
+}
+
+std::vector<uint16_t> Cfg::successors(uint16_t leader) const {
+    auto addrs = block(leader);
+    if (addrs.empty()) return {};
+    const auto& last = instrs.at(addrs.back());
+    uint16_t next = addrs.back() + last.size();
+    std::vector<uint16_t> succ;
+    auto add = [&](uint16_t addr) {
+        if (is_leader(addr)) succ.push_back(addr);
+    };
+    switch (last.op) {
+        case Opcode::Halt:
+        case Opcode::Ret: break;
+        case Opcode::Jmp:
+            if (last.args[0] < kMaxInt) add(last.args[0]);
+            break;
+        case Opcode::Jt:
+        case Opcode::Jf:
+            if (last.args[1] < kMaxInt) add(last.args[1]);
+            add(next);
+            break;
+        default: add(next);
+    }
+    return succ;
+}
+
+std::vector<uint16_t> live_entries(const VM& vm) {
+    std::vector<uint16_t> entries = {vm.pc()};
+    for (auto val : vm.stack()) {
+        if (val >= 2 && val < kMaxInt &&
+            vm.peek(val - 2) == static_cast<uint16_t>(Opcode::Call)) {
+            entries.push_back(val);
+        }
+    }
+    return entries;
+}
+
+namespace {
+
+// The instruction at |addr| as the disassembler prints it, with |mem|
+// holding its words.
+void append_at(std::string& out, const std::vector<uint16_t>& mem,
+               uint16_t addr) {
+    uint16_t words[4] = {};
+    for (int i = 0; i < 4 && addr + i < static_cast<int>(mem.size()); i++) {
+        words[i] = mem[addr + i];
+    }
+    append_instr(out, addr, words);
+}
+
+void format_text(const Cfg& cfg, const std::vector<uint16_t>& mem,
+                 std::string& out) {
+    for (const auto& [entry, blocks] : cfg.functions) {
+        out += "function ";
+        append_number(out, entry);
+        out += ": ";
+        append_number(out, blocks.size());
+        out += blocks.size() == 1 ? " block\n" : " blocks\n";
+    }
+    uint16_t end = 0;  // the word after the previous block
+    for (auto leader : cfg.leaders) {
+        auto addrs = cfg.block(leader);
+        if (addrs.empty()) continue;
+        out += '\n';
+        if (leader > end) {
+            out += "; ";
+            append_number(out, leader - end);
+            out += " words of data\n\n";
+        }
+        append_number(out, leader);
+        out += ":\n";
+        for (auto addr : addrs) append_at(out, mem, addr);
+        auto succ = cfg.successors(leader);
+        if (!succ.empty()) {
+            out += "  ->";
+            for (auto next : succ) {
+                out += ' ';
+                append_number(out, next);
+            }
+            out += '\n';
+        }
+        end = addrs.back() + cfg.instrs.at(addrs.back()).size();
+    }
+}
+
+void format_dot(const Cfg& cfg, const std::vector<uint16_t>& mem,
+                std::string& out) {
+    out += "digraph cfg {\n";
+    out += "    node [shape=box fontname=monospace];\n";
+    // "    b<from> -> b<to>"
+    auto edge = [&](uint16_t from, uint16_t to) {
+        out += "    b";
+        append_number(out, from);
+        out += " -> b";
+        append_number(out, to);
+    };
+    for (auto leader : cfg.leaders) {
+        auto addrs = cfg.block(leader);
+        if (addrs.empty()) continue;
+        out += "    b";
+        append_number(out, leader);
+        out += " [label=\"";
+        for (auto addr : addrs) {
+            append_at(out, mem, addr);
+            out.pop_back();
+            out += "\\l";
+        }
+        out += "\"";
+        if (cfg.functions.count(leader)) out += " penwidth=2";
+        out += "];\n";
+        for (auto next : cfg.successors(leader)) {
+            edge(leader, next);
+            out += ";\n";
+        }
+        const auto& last = cfg.instrs.at(addrs.back());
+        if (last.op == Opcode::Call && last.args[0] < kMaxInt &&
+            cfg.is_leader(last.args[0])) {
+            edge(leader, last.args[0]);
+            out += " [style=dashed];\n";
+        }
+    }
+    out += "}\n";
+}
+
+}  // namespace
+
+void format_cfg(const Cfg& cfg, const std::vector<uint16_t>& mem,
+                CfgFormat format, std::string& out) {
+    switch (format) {
+        case CfgFormat::Text: format_text(cfg, mem, out); break;
+        case CfgFormat::Dot: format_dot(cfg, mem, out); break;
+    }
+}
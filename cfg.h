@@ -0,0 +1,72 @@
+#ifndef CFG_H_
+#define CFG_H_
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "vm.h"
+
+// An instruction recovered from a memory image, with raw operands.
+struct Instr {
+    Opcode op;
+    uint16_t args[3];
+
+    uint16_t size() const { return arity(op) + 1; }
+};
+
+// Decodes the instruction at |addr|, or returns nothing if the words there
+// are not a valid instruction.
+std::optional<Instr> decode_at(const std::vector<uint16_t>& mem, uint16_t addr);
+
+// Code recovered from a memory image by following control flow from a set
+// of entry points instead of scanning it linearly, so that data is never
+// mistaken for instructions.
+struct Cfg {
+    std::map<uint16_t, Instr> instrs;  // by address
+    std::set<uint16_t> leaders;        // first instructions of basic blocks
+    std::vector<bool> code;            // words covered by instrs
+
+    // Functions by entry point: the entries passed to recover_cfg, call
+    // targets and code found through literals, each with the blocks
+    // reachable from it without following calls. Blocks can belong to more
+    // than one function.
+    std::map<uint16_t, std::set<uint16_t>> functions;
+
+    bool is_code(uint16_t addr) const {
+        return addr < code.size() && code[addr];
+    }
+    bool is_leader(uint16_t addr) const { return leaders.count(addr) > 0; }
+
+    // Addresses of the instructions in the block starting at |leader|.
+    std::vector<uint16_t> block(uint16_t leader) const;
+
+    // Blocks that control can reach from the end of the block starting at
+    // |leader| with a literal target, treating calls as returning.
+    std::vector<uint16_t> successors(uint16_t leader) const;
+};
+
+// Follows Jmp/Jt/Jf/Call targets and fallthrough from |entries|. Targets
+// held in registers are unknown statically, so literals that recovered code
+// sets or pushes (callbacks passed to routines) are also tried as entry
+// points when they decode into a run of valid instructions.
+Cfg recover_cfg(const std::vector<uint16_t>& mem,
+                const std::vector<uint16_t>& entries);
+
+// Entry points of a running program: |vm|'s pc, and the return addresses
+// on its stack that really follow a call.
+std::vector<uint16_t> live_entries(const VM& vm);
+
+enum class CfgFormat {
+    Text,  // a listing of each block, with its successors
+    Dot,   // a graphviz digraph of blocks, with calls as dashed edges
+};
+
+// Appends |cfg| to |out| in |format|. |mem| is the image it came from.
+void format_cfg(const Cfg& cfg, const std::vector<uint16_t>& mem,
+                CfgFormat format, std::string& out);
+
+#endif  // CFG_H_
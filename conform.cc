@@ -0,0 +1,670 @@
+#include "conform.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "mapping.h"
+#include "profile.h"
+#include "translate.h"
+#include "vm.h"
+
+namespace {
+
+// Random programs run for at most this many instructions, compared every
+// kRandomInterval of them.
+static constexpr uint64_t kRandomSteps = 4096;
+static constexpr uint64_t kRandomInterval = 64;
+
+// Shrinking stops once a round removes nothing, or after this many.
+static constexpr int kShrinkRounds = 16;
+
+using Page = std::array<uint16_t, VM::kPageWords>;
+using Pages = std::bitset<VM::kPages>;
+
+enum class Stop {
+    Running,    // reached a checkpoint or the step limit
+    Halted,
+    Blocked,    // In with no input left
+    Invalid,    // an invalid instruction or an empty-stack Pop, which the
+                // VM throws on
+    Undefined,  // the next instruction is undefined in the fast loops
+};
+
+// The reference's state after |steps| instructions. Only the pages it
+// wrote are kept; the others still hold the program.
+struct Checkpoint {
+    uint64_t steps;
+    Stop stop;
+    uint16_t pc;
+    std::array<uint16_t, kNumReg> regs;
+    std::vector<uint16_t> stack;
+    std::string out;
+    Pages written;
+    std::map<size_t, Page> pages;
+};
+
+// The spec, interpreted as plainly as possible: no decoded cache, no
+// pages, every instruction validated as it runs.
+class Reference {
+public:
+    Reference(const std::vector<uint16_t>& program, std::string input)
+        : mem_(kMaxInt), input_(std::move(input)) {
+        std::copy(program.begin(), program.end(), mem_.begin());
+    }
+
+    // Runs until |steps| instructions have run in all, or it stops.
+    Stop run(uint64_t steps) {
+        while (steps_ < steps) {
+            auto stop = step();
+            if (stop != Stop::Running) return stop;
+        }
+        return Stop::Running;
+    }
+
+    Checkpoint checkpoint(Stop stop) const {
+        Checkpoint cp{steps_, stop, pc_, regs_, stack_, out_, written_, {}};
+        for (size_t page = 0; page < VM::kPages; page++) {
+            if (!written_[page]) continue;
+            std::copy_n(&mem_[page * VM::kPageWords], VM::kPageWords,
+                        cp.pages[page].begin());
+        }
+        return cp;
+    }
+
+private:
+    Stop step();
+
+    std::vector<uint16_t> mem_;
+    std::array<uint16_t, kNumReg> regs_{};
+    std::vector<uint16_t> stack_;
+    uint16_t pc_ = 0;
+    uint64_t steps_ = 0;
+    std::string input_;
+    size_t in_pos_ = 0;
+    std::string out_;
+    Pages written_;
+};
+
+Stop Reference::step() {
+    if (!is_opcode(mem_[pc_])) return Stop::Invalid;
+    auto op = static_cast<Opcode>(mem_[pc_]);
+    int n = arity(op);
+    // the checked loop throws where the others wrap around
+    if (pc_ + n + 1 >= kMaxInt) return Stop::Undefined;
+    uint16_t raw[3] = {};
+    for (int i = 0; i < n; i++) {
+        raw[i] = mem_[pc_ + 1 + i];
+        if (raw[i] >= kMaxInt + kNumReg) return Stop::Invalid;
+    }
+    if (writes_first_arg(op) && raw[0] < kMaxInt) return Stop::Invalid;
+
+    auto val = [&](int i) -> uint16_t {
+        return raw[i] < kMaxInt ? raw[i] : regs_[raw[i] - kMaxInt];
+    };
+    auto set = [&](uint16_t v) { regs_[raw[0] - kMaxInt] = v; };
+    uint16_t next = pc_ + n + 1;
+    switch (op) {
+        case Opcode::Halt:
+            pc_ = next;
+            steps_++;
+            return Stop::Halted;
+        case Opcode::Set: set(val(1)); break;
+        case Opcode::Push: stack_.push_back(val(0)); break;
+        case Opcode::Pop:
+            if (stack_.empty()) return Stop::Invalid;
+            set(stack_.back());
+            stack_.pop_back();
+            break;
+        case Opcode::Eq: set(val(1) == val(2)); break;
+        case Opcode::Gt: set(val(1) > val(2)); break;
+        case Opcode::Jmp: next = val(0); break;
+        case Opcode::Jt:
+            if (val(0) != 0) next = val(1);
+            break;
+        case Opcode::Jf:
+            if (val(0) == 0) next = val(1);
+            break;
+        case Opcode::Add: set((val(1) + val(2)) % kMaxInt); break;
+        case Opcode::Mult: set(uint32_t(val(1)) * val(2) % kMaxInt); break;
+        case Opcode::Mod:
+            if (val(2) == 0) return Stop::Undefined;
+            set(val(1) % val(2));
+            break;
+        case Opcode::And: set(val(1) & val(2)); break;
+        case Opcode::Or: set(val(1) | val(2)); break;
+        case Opcode::Not: set(~val(1) & (kMaxInt - 1)); break;
+        case Opcode::Rmem: set(mem_[val(1)]); break;
+        case Opcode::Wmem:
+            mem_[val(0)] = val(1);
+            written_.set(val(0) / VM::kPageWords);
+            break;
+        case Opcode::Call:
+            stack_.push_back(next);
+            next = val(0);
+            break;
+        case Opcode::Ret:
+            if (stack_.empty()) {
+                pc_ = next;
+                steps_++;
+                return Stop::Halted;
+            }
+            next = stack_.back();
+            stack_.pop_back();
+            break;
+        case Opcode::Out: out_ += static_cast<char>(val(0)); break;
+        case Opcode::In:
+            if (in_pos_ == input_.size()) return Stop::Blocked;
+            set(static_cast<uint8_t>(input_[in_pos_++]));
+            break;
+        case Opcode::Noop: break;
+    }
+    pc_ = next;
+    steps_++;
+    return Stop::Running;
+}
+
+std::vector<Checkpoint> record(const std::vector<uint16_t>& program,
+                               const std::string& input, uint64_t max_steps,
+                               uint64_t interval) {
+    Reference ref(program, input);
+    std::vector<Checkpoint> checkpoints;
+    for (uint64_t steps = interval;; steps += interval) {
+        auto stop = ref.run(std::min(steps, max_steps));
+        checkpoints.push_back(ref.checkpoint(stop));
+        if (stop != Stop::Running || steps >= max_steps) break;
+    }
+    return checkpoints;
+}
+
+struct Engine {
+    const char* name;
+    bool step;     // single steps instead of the dispatch loop
+    bool checked;  // the checked loop
+    bool profile;  // the profiling loop
+    bool fork;     // continue on a fork at each checkpoint
+};
+
+// The first is also the reference for state hashes.
+static const Engine kEngines[] = {
+    {"run", false, false, false, false},
+    {"step", true, false, false, false},
+    {"checked", false, true, false, false},
+    {"profile", false, false, true, false},
+    {"fork", false, false, false, true},
+};
+
+const char* to_string(VM::State state) {
+    switch (state) {
+        case VM::State::Run: return "run";
+        case VM::State::Halt: return "halt";
+        case VM::State::Out: return "out";
+        case VM::State::In: return "in";
+    }
+}
+
+VM::State expected_state(Stop stop) {
+    switch (stop) {
+        case Stop::Halted: return VM::State::Halt;
+        case Stop::Blocked: return VM::State::In;
+        default: return VM::State::Run;
+    }
+}
+
+// Describes the first difference between |vm|, which printed |out| and
+// threw if |threw|, and |cp|.
+std::optional<std::string> compare(const VM& vm, const std::string& out,
+                                   bool threw,
+                                   const std::vector<uint16_t>& program,
+                                   const Checkpoint& cp) {
+    auto num = [](uint64_t val) { return std::to_string(val); };
+    if (threw != (cp.stop == Stop::Invalid)) {
+        return threw ? "threw on a valid instruction"
+                     : "ran an invalid instruction";
+    }
+    // single steps stop after every Out, which the loops run through
+    auto state = vm.state() == VM::State::Out ? VM::State::Run : vm.state();
+    if (state != expected_state(cp.stop)) {
+        return std::string("state ") + to_string(state) + ", expected " +
+               to_string(expected_state(cp.stop));
+    }
+    if (vm.pc() != cp.pc) return "pc " + num(vm.pc()) + ", expected " +
+                                  num(cp.pc);
+    for (size_t i = 0; i < kNumReg; i++) {
+        if (vm.reg(i) != cp.regs[i]) {
+            return "r" + num(i) + " = " + num(vm.reg(i)) + ", expected " +
+                   num(cp.regs[i]);
+        }
+    }
+    if (vm.stack() != cp.stack) {
+        return "stack of " + num(vm.stack().size()) + " differs from " +
+               num(cp.stack.size()) + " expected";
+    }
+    if (out != cp.out) {
+        return "output of " + num(out.size()) + " characters differs from " +
+               num(cp.out.size()) + " expected";
+    }
+    auto pages = cp.written | vm.dirty_pages();
+    for (size_t page = 0; page < VM::kPages; page++) {
+        if (!pages[page]) continue;
+        auto it = cp.pages.find(page);
+        for (size_t i = 0; i < VM::kPageWords; i++) {
+            size_t addr = page * VM::kPageWords + i;
+            uint16_t expected = it != cp.pages.end() ? it->second[i]
+                                : addr < program.size() ? program[addr]
+                                                        : 0;
+            if (vm.peek(addr) != expected) {
+                return "mem[" + num(addr) + "] = " + num(vm.peek(addr)) +
+                       ", expected " + num(expected);
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+// Runs |engine| through |checkpoints|. |hashes| holds the state hash at
+// each checkpoint of the first engine, which fills it in.
+std::optional<std::string> check(const Engine& engine,
+                                 const std::vector<uint16_t>& program,
+                                 const std::string& input,
+                                 const std::vector<Checkpoint>& checkpoints,
+                                 std::vector<uint64_t>& hashes) {
+    VM::Options options;
+    options.checked = engine.checked;
+    if (engine.profile) options.profile = std::make_shared<Profile>();
+    VM vm(program, options);
+    vm.input(input);
+    std::optional<VM> parent;
+    std::string out, parent_out;
+    uint64_t steps = 0;
+    for (size_t i = 0; i < checkpoints.size(); i++) {
+        const auto& cp = checkpoints[i];
+        // the VM spends budget on reaching the In or invalid instruction
+        // that the reference stops in front of
+        uint64_t budget = cp.steps - steps;
+        if (cp.stop == Stop::Blocked || cp.stop == Stop::Invalid) budget++;
+        steps = cp.steps;
+        bool threw = false;
+        try {
+            if (engine.step) {
+                for (uint64_t j = 0; j < budget; j++) {
+                    vm.step();
+                    if (vm.state() == VM::State::Out) out += vm.output();
+                    if (vm.state() == VM::State::Halt ||
+                        vm.state() == VM::State::In) {
+                        break;
+                    }
+                }
+            } else {
+                vm.run(out, budget);
+            }
+        } catch (const std::exception&) {
+            threw = true;
+        }
+        auto at = "after " + std::to_string(cp.steps) + " instructions: ";
+        if (auto diff = compare(vm, out, threw, program, cp)) {
+            return at + *diff;
+        }
+        if (vm.state() != VM::State::Out) {
+            if (hashes.size() == i) hashes.push_back(vm.state_hash());
+            if (hashes[i] != vm.state_hash()) {
+                return at + "state hash differs from " + kEngines[0].name;
+            }
+        }
+        if (parent) {
+            const auto& prev = checkpoints[i - 1];
+            auto diff = compare(*parent, parent_out, false, program, prev);
+            if (diff) return at + "the fork's parent changed: " + *diff;
+        }
+        if (engine.fork) {
+            parent.emplace(vm);
+            parent_out = out;
+            vm = parent->fork();
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<Divergence> check_all(const std::vector<uint16_t>& program,
+                                    const std::string& input,
+                                    uint64_t max_steps, uint64_t interval,
+                                    uint64_t& steps) {
+    auto checkpoints = record(program, input, max_steps, interval);
+    steps = checkpoints.back().steps;
+    std::vector<uint64_t> hashes;
+    for (const auto& engine : kEngines) {
+        if (auto what = check(engine, program, input, checkpoints, hashes)) {
+            return Divergence{engine.name, *what, program, input};
+        }
+    }
+    return std::nullopt;
+}
+
+constexpr uint16_t op(Opcode op) { return static_cast<uint16_t>(op); }
+constexpr uint16_t reg(int i) { return kMaxInt + i; }
+
+struct EdgeCase {
+    std::vector<uint16_t> program;
+    std::string input;
+};
+
+std::vector<EdgeCase> edge_cases() {
+    using O = Opcode;
+    return {
+        // 15-bit wraparound
+        {{op(O::Add), reg(0), 32767, 1,
+          op(O::Add), reg(1), 32767, 32767,
+          op(O::Mult), reg(2), 32767, 32767,
+          op(O::Mult), reg(3), 16384, 2,
+          op(O::Not), reg(4), 0,
+          op(O::Not), reg(5), 32767,
+          op(O::Mod), reg(6), 32767, 32766,
+          op(O::Halt)}, ""},
+        // Ret on an empty stack halts, after returning once
+        {{op(O::Ret)}, ""},
+        {{op(O::Call), 3, op(O::Ret), op(O::Ret)}, ""},
+        {{op(O::Push), 1, op(O::Push), 2, op(O::Pop), reg(0),
+          op(O::Pop), reg(1), op(O::Gt), reg(2), reg(0), reg(1),
+          op(O::Eq), reg(3), reg(2), 1, op(O::Halt)}, ""},
+        // rewrites the operand of an Out that has already run, and the
+        // Halt that ends the loop
+        {{op(O::Set), reg(0), 'b',
+          op(O::Out), 'a',
+          op(O::Jt), reg(1), 17,
+          op(O::Wmem), 4, reg(0),
+          op(O::Set), reg(1), 1,
+          op(O::Jmp), 3,
+          op(O::Noop),
+          op(O::Wmem), 17, op(O::Noop),
+          op(O::Halt)}, ""},
+        // popping an empty stack, at once and after a push
+        {{op(O::Pop), reg(0)}, ""},
+        {{op(O::Push), 1, op(O::Pop), reg(0), op(O::Pop), reg(1)}, ""},
+        // and inside a call that popped its own return address, after output
+        {{op(O::Call), 3, op(O::Halt), op(O::Out), 'a', op(O::Pop), reg(0),
+          op(O::Pop), reg(1), op(O::Ret)}, ""},
+        // echoes its input, then blocks
+        {{op(O::In), reg(0), op(O::Out), reg(0), op(O::Jmp), 0}, "hi\n"},
+        {{op(O::In), reg(0)}, ""},
+        // invalid opcodes, operands and destinations
+        {{22}, ""},
+        {{op(O::Add), reg(0), kMaxInt + kNumReg, 1}, ""},
+        {{op(O::Set), 5, 1}, ""},
+        // running off the end of the program into zeroed memory
+        {{op(O::Noop), op(O::Noop)}, ""},
+        // a called function with a block below its root
+        {{op(O::Call), 8,
+          op(O::Out), '\n',
+          op(O::Halt),
+          op(O::Out), 'b',
+          op(O::Ret),
+          op(O::Out), 'a',
+          op(O::Jmp), 5}, ""},
+    };
+}
+
+// A random program, and the addresses its instructions start at.
+struct Program {
+    std::vector<uint16_t> words;
+    std::vector<uint16_t> starts;
+};
+
+// Mostly valid programs, weighted towards edge-case values, with jumps
+// into their own instructions and writes into their own code.
+class Generator {
+public:
+    explicit Generator(uint64_t seed) : rng_(seed) {}
+
+    Program program();
+
+    std::string input() {
+        static constexpr char kChars[] = "ab z\n";
+        std::string input(pick(9), ' ');
+        for (auto& ch : input) ch = kChars[pick(sizeof(kChars) - 1)];
+        return input;
+    }
+
+private:
+    size_t pick(size_t n) {
+        return std::uniform_int_distribution<size_t>(0, n - 1)(rng_);
+    }
+    bool one_in(size_t n) { return pick(n) == 0; }
+
+    uint16_t any_reg() { return reg(pick(kNumReg)); }
+
+    uint16_t literal() {
+        static constexpr uint16_t kEdges[] = {0,     1,     2,    255,
+                                              16384, 32766, 32767};
+        if (one_in(2)) return kEdges[pick(std::size(kEdges))];
+        return pick(kMaxInt);
+    }
+
+    uint16_t value() {
+        if (one_in(64)) return kMaxInt + kNumReg + pick(16);  // invalid
+        return one_in(2) ? any_reg() : literal();
+    }
+
+    std::mt19937_64 rng_;
+};
+
+Program Generator::program() {
+    using O = Opcode;
+    static constexpr Opcode kOps[] = {
+        O::Set,  O::Set,  O::Push, O::Push, O::Pop,  O::Pop,  O::Eq,
+        O::Gt,   O::Jmp,  O::Jt,   O::Jt,   O::Jf,   O::Jf,   O::Add,
+        O::Add,  O::Mult, O::Mult, O::Mod,  O::And,  O::Or,   O::Not,
+        O::Rmem, O::Wmem, O::Wmem, O::Call, O::Call, O::Ret,  O::Out,
+        O::Out,  O::In,   O::Noop, O::Halt,
+    };
+    // opcodes first, so that jumps can target any instruction
+    std::vector<Opcode> ops(4 + pick(44));
+    Program p;
+    uint16_t end = 0;
+    for (auto& o : ops) {
+        o = kOps[pick(std::size(kOps))];
+        p.starts.push_back(end);
+        end += arity(o) + 1;
+    }
+    auto target = [&]() -> uint16_t {
+        if (one_in(8)) return value();
+        return one_in(16) ? end : p.starts[pick(p.starts.size())];
+    };
+    auto address = [&]() -> uint16_t {
+        switch (pick(3)) {
+            case 0: return pick(end);        // its own code
+            case 1: return end + pick(256);  // data
+            default: return value();
+        }
+    };
+    for (auto o : ops) {
+        p.words.push_back(op(o));
+        for (int i = 0; i < arity(o); i++) {
+            bool jump = (o == O::Jmp || o == O::Call) ||
+                        ((o == O::Jt || o == O::Jf) && i == 1);
+            if (i == 0 && writes_first_arg(o)) {
+                p.words.push_back(one_in(64) ? literal() : any_reg());
+            } else if (jump) {
+                p.words.push_back(target());
+            } else if ((o == O::Wmem && i == 0) || (o == O::Rmem && i == 1)) {
+                p.words.push_back(address());
+            } else if (o == O::Out && one_in(2)) {
+                p.words.push_back(one_in(8) ? '\n' : 'a' + pick(26));
+            } else {
+                p.words.push_back(value());
+            }
+        }
+    }
+    return p;
+}
+
+// Cuts |p| and |input| down while they still diverge, returning the last
+// divergence found.
+Divergence shrink(Program p, std::string input, Divergence found) {
+    auto diverges = [&](const std::vector<uint16_t>& words,
+                        const std::string& in) {
+        uint64_t steps;
+        auto d = check_all(words, in, kRandomSteps, kRandomInterval, steps);
+        if (d) found = std::move(*d);
+        return d.has_value();
+    };
+    bool progress = true;
+    for (int round = 0; progress && round < kShrinkRounds; round++) {
+        progress = false;
+        // memory past the end reads as Halt
+        while (!p.starts.empty()) {
+            std::vector<uint16_t> words(p.words.begin(),
+                                        p.words.begin() + p.starts.back());
+            if (!diverges(words, input)) break;
+            p.words = std::move(words);
+            p.starts.pop_back();
+            progress = true;
+        }
+        // Noops keep every address in place
+        for (size_t i = 0; i < p.starts.size(); i++) {
+            size_t start = p.starts[i];
+            size_t next = i + 1 < p.starts.size() ? p.starts[i + 1]
+                                                  : p.words.size();
+            auto words = p.words;
+            std::fill(&words[start], &words[0] + next, op(Opcode::Noop));
+            if (words == p.words || !diverges(words, input)) continue;
+            p.words = std::move(words);
+            progress = true;
+        }
+        for (size_t i = 0; i < input.size();) {
+            auto shorter = input;
+            shorter.erase(i, 1);
+            if (!diverges(p.words, shorter)) {
+                i++;
+                continue;
+            }
+            input = std::move(shorter);
+            progress = true;
+        }
+    }
+    return found;
+}
+
+// Runs |cmd| through the shell, throwing if it fails.
+void shell(const std::string& cmd) {
+    if (system(cmd.c_str()) != 0) {
+        throw std::runtime_error("failed: " + cmd);
+    }
+}
+
+// Builds the translation of |program| from its first instruction with
+// |build| in |dir|, runs it on |input| and compares its output with the
+// reference's, and whether it failed with whether the reference stopped on
+// an invalid instruction. Only programs the reference finishes within
+// |max_steps| are compared: the translated code has no instruction budget,
+// and leaves what the reference calls undefined to C++. Sets |checked| if
+// the program was compared.
+std::optional<Divergence> check_translated(
+    const std::vector<uint16_t>& program, const std::string& input,
+    const std::string& build, const std::string& dir, uint64_t max_steps,
+    bool& checked) {
+    auto cp = record(program, input, max_steps, max_steps).back();
+    checked = cp.stop == Stop::Halted || cp.stop == Stop::Blocked ||
+              cp.stop == Stop::Invalid;
+    if (!checked) return std::nullopt;
+
+    VM vm(program);
+    std::ofstream src(dir + "/game.cc");
+    translate(vm, "", src);
+    src.close();
+    std::ofstream(dir + "/input") << input;
+    shell(build + " " + dir + "/game.cc -o " + dir + "/game");
+    bool failed = system((dir + "/game < " + dir + "/input > " + dir +
+                          "/output 2> /dev/null")
+                             .c_str()) != 0;
+    std::ifstream is(dir + "/output");
+    std::string out{std::istreambuf_iterator<char>(is), {}};
+    if (failed != (cp.stop == Stop::Invalid)) {
+        return Divergence{"translated",
+                          failed ? "failed on a valid instruction"
+                                 : "ran an invalid instruction",
+                          program, input};
+    }
+    if (out == cp.out) return std::nullopt;
+    return Divergence{"translated",
+                      "output of " + std::to_string(out.size()) +
+                          " characters differs from " +
+                          std::to_string(cp.out.size()) + " expected",
+                      program, input};
+}
+
+}  // namespace
+
+std::optional<Divergence> conform(const std::vector<uint16_t>& program,
+                                  const std::string& input,
+                                  uint64_t max_steps, uint64_t interval) {
+    uint64_t steps;
+    return check_all(program, input, max_steps, interval, steps);
+}
+
+ConformResult conform_random(uint64_t seed, size_t programs) {
+    ConformResult result;
+    for (const auto& edge : edge_cases()) {
+        uint64_t steps;
+        // small enough to compare after every instruction
+        auto d = check_all(edge.program, edge.input, kRandomSteps, 1, steps);
+        result.programs++;
+        result.instructions += steps;
+        if (d) result.divergences.push_back(std::move(*d));
+    }
+    Generator gen(seed);
+    for (size_t i = 0; i < programs; i++) {
+        auto p = gen.program();
+        auto input = gen.input();
+        uint64_t steps;
+        auto d = check_all(p.words, input, kRandomSteps, kRandomInterval,
+                           steps);
+        result.programs++;
+        result.instructions += steps;
+        if (d) {
+            result.divergences.push_back(
+                shrink(std::move(p), std::move(input), std::move(*d)));
+        }
+    }
+    return result;
+}
+
+ConformResult conform_translated(uint64_t seed, size_t programs,
+                                 const std::string& build) {
+    char dir[] = "/tmp/conformXXXXXX";
+    if (mkdtemp(dir) == nullptr) throw sys_error("mkdtemp");
+    ConformResult result;
+    auto check = [&](const std::vector<uint16_t>& program,
+                     const std::string& input) {
+        bool checked;
+        auto d = check_translated(program, input, build, dir, kRandomSteps,
+                                  checked);
+        result.programs += checked;
+        if (d) result.divergences.push_back(std::move(*d));
+        return checked;
+    };
+    try {
+        for (const auto& edge : edge_cases()) check(edge.program, edge.input);
+        // compiling is slow, so only programs that finish count
+        Generator gen(seed);
+        for (size_t n = 0; n < programs;) {
+            auto p = gen.program();
+            n += check(p.words, gen.input());
+        }
+    } catch (...) {
+        shell(std::string("rm -rf ") + dir);
+        throw;
+    }
+    shell(std::string("rm -rf ") + dir);
+    return result;
+}
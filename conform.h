@@ -0,0 +1,58 @@
+#ifndef CONFORM_H_
+#define CONFORM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Differential checks of the VM's execution engines (the dispatch loop,
+// single steps, the checked and profiling loops, and forks continuing
+// where their parent stopped) against a reference interpreter written
+// straight from the architecture spec. Each engine runs the program from
+// the start and is compared at every checkpoint the reference recorded:
+// state, pc, registers, stack, output and every memory page either side
+// wrote. Execution stops short of instructions whose result the fast loops
+// leave undefined (Mod by zero, pc running off the end of memory), since
+// the engines are allowed to differ there. The
+// ahead-of-time translation to C++ is checked separately, as it has to be
+// compiled.
+
+struct Divergence {
+    std::string engine;
+    std::string what;  // the first mismatch
+    std::vector<uint16_t> program;
+    std::string input;
+};
+
+// Runs |program| with |input| queued on every engine for at most
+// |max_steps| instructions, comparing every |interval| instructions.
+// Returns the first divergence found, if any.
+std::optional<Divergence> conform(const std::vector<uint16_t>& program,
+                                  const std::string& input,
+                                  uint64_t max_steps, uint64_t interval);
+
+struct ConformResult {
+    size_t programs = 0;
+    uint64_t instructions = 0;  // executed by the reference
+    std::vector<Divergence> divergences;
+};
+
+// Checks a fixed set of edge cases (15-bit wraparound, Ret on an empty
+// stack, self-modifying code, blocking on input) and then |programs|
+// random ones generated from |seed|. Divergences in random programs are
+// shrunk to as few instructions and input characters as still diverge.
+ConformResult conform_random(uint64_t seed, size_t programs);
+
+// Checks the C++ translation of the edge cases that finish, and of
+// |programs| random ones from |seed| that do, by building each with
+// |build|, a compiler command that links the translator's runtime objects
+// (see translate.h), and comparing its output with the reference's. Only
+// output, and whether it fails where the reference hits an invalid
+// instruction, is compared, since the translation keeps its state to
+// itself. Throws std::runtime_error if a build fails.
+ConformResult conform_translated(uint64_t seed, size_t programs,
+                                 const std::string& build);
+
+#endif  // CONFORM_H_
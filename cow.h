@@ -0,0 +1,61 @@
+#ifndef COW_H_
+#define COW_H_
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+// A copy-on-write handle to a T. Copying a handle shares the value; mut()
+// makes a private copy first if any other handle shares it. Handles that
+// share a value can live on different threads: a value is only written
+// through a handle that holds the sole reference, and a reference can only
+// be added by copying an existing handle, which the owning thread does.
+template <typename T>
+class Cow {
+public:
+    Cow() : block_(new Block{}) {}
+    explicit Cow(const T& val) : block_(new Block{{1}, val}) {}
+    Cow(const Cow& other) : block_(other.block_) { ref(); }
+    Cow(Cow&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {}
+    Cow& operator=(Cow other) noexcept {
+        std::swap(block_, other.block_);
+        return *this;
+    }
+    ~Cow() { unref(); }
+
+    const T& operator*() const { return block_->val; }
+    const T* operator->() const { return &block_->val; }
+
+    T& mut() {
+        // acquire pairs with the release in other handles' unref(), so
+        // their reads of the value happen before our writes
+        if (block_->refs.load(std::memory_order_acquire) != 1) {
+            Block* copy = new Block{{1}, block_->val};
+            unref();
+            block_ = copy;
+        }
+        return block_->val;
+    }
+
+    bool shared() const {
+        return block_->refs.load(std::memory_order_acquire) != 1;
+    }
+
+private:
+    struct Block {
+        std::atomic<uint32_t> refs{1};
+        T val;
+    };
+
+    void ref() { block_->refs.fetch_add(1, std::memory_order_relaxed); }
+    void unref() {
+        if (block_ != nullptr &&
+            block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete block_;
+        }
+    }
+
+    Block* block_;
+};
+
+#endif  // COW_H_
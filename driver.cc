@@ -0,0 +1,38 @@
+#include "driver.h"
+
+#include <string>
+
+namespace {
+
+// Keeps the response for the driver while passing it on.
+class TeeSink final : public Sink {
+public:
+    explicit TeeSink(Sink& out) : out_(out) {}
+    void write(std::string_view line) override {
+        text.append(line);
+        out_.write(line);
+    }
+    void flush() override { out_.flush(); }
+
+    std::string text;  // reused for every response
+
+private:
+    Sink& out_;
+};
+
+}  // namespace
+
+void drive(Game& game, Driver driver, Sink& out) {
+    auto handle = driver.handle_;
+    auto& promise = handle.promise();
+    TeeSink tee(out);
+    handle.resume();
+    while (!handle.done() && game.state() != Game::State::GameOver) {
+        auto* command = std::exchange(promise.pending, nullptr);
+        tee.text.clear();
+        game.input(command->cmd, tee);
+        command->response = tee.text;
+        handle.resume();
+    }
+    if (promise.error) std::rethrow_exception(promise.error);
+}
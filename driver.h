@@ -0,0 +1,69 @@
+#ifndef DRIVER_H_
+#define DRIVER_H_
+
+#include <coroutine>
+#include <exception>
+#include <string_view>
+#include <utility>
+
+#include "game.h"
+#include "sink.h"
+
+// A game driver written as a coroutine. It co_awaits command(...) for each
+// command and gets the game's response back, so a whole playthrough reads
+// as straight-line code. drive() resumes it once per command, after the VM
+// has run up to its next input, instead of the driver polling the game.
+class Driver {
+public:
+    struct Command;
+
+    struct promise_type {
+        Command* pending = nullptr;  // the command being awaited
+        std::exception_ptr error;
+
+        Driver get_return_object() {
+            return Driver(Handle::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    // Awaited by a driver: sends |cmd| to the game and resumes with its
+    // response, which stays valid until the next command.
+    struct Command {
+        std::string_view cmd;
+        std::string_view response;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle handle) noexcept {
+            handle.promise().pending = this;
+        }
+        std::string_view await_resume() const noexcept { return response; }
+    };
+
+    Driver(Driver&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {}
+    Driver& operator=(Driver&&) = delete;
+    ~Driver() {
+        if (handle_) handle_.destroy();
+    }
+
+private:
+    explicit Driver(Handle handle) : handle_(handle) {}
+
+    Handle handle_;
+
+    friend void drive(Game& game, Driver driver, Sink& out);
+};
+
+inline Driver::Command command(std::string_view cmd) { return {cmd, {}}; }
+
+// Runs |driver| on |game| until the driver returns or the game ends,
+// streaming every response to |out| as well. Rethrows what the driver
+// throws.
+void drive(Game& game, Driver driver, Sink& out);
+
+#endif  // DRIVER_H_
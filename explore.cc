@@ -0,0 +1,240 @@
+#include "explore.h"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+#include "hooks.h"
+
+namespace {
+
+static constexpr size_t kCodeLength = 12;
+
+struct Node {
+    std::optional<Game> game;  // dropped once expanded
+    std::string look;
+    size_t parent;  // index in the node list, or kRoot
+    std::string cmd;
+};
+
+static constexpr size_t kRoot = static_cast<size_t>(-1);
+
+// What expanding a node produced: its children, in command order.
+struct Child {
+    std::optional<Game> game;  // unset if the game ended
+    std::string cmd;
+    std::string out;
+    std::string look;
+};
+
+// Runs a task on |threads| workers, the caller included, and waits for all
+// of them. The threads last as long as the pool, since a search has
+// thousands of small levels.
+class Pool {
+public:
+    explicit Pool(unsigned threads) {
+        for (unsigned i = 1; i < threads; i++) {
+            workers_.emplace_back(&Pool::work, this);
+        }
+    }
+    ~Pool() {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto& worker : workers_) worker.join();
+    }
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    // Runs |task| on every worker and returns once each has finished.
+    void run(const std::function<void()>& task) {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            task_ = &task;
+            round_++;
+            running_ = workers_.size();
+        }
+        start_cv_.notify_all();
+        task();
+        std::unique_lock<std::mutex> lock(mu_);
+        done_cv_.wait(lock, [&] { return running_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    void work() {
+        // a round only starts once every worker finished the last one, so
+        // none is missed
+        uint64_t done = 0;
+        while (true) {
+            const std::function<void()>* task;
+            {
+                std::unique_lock<std::mutex> lock(mu_);
+                start_cv_.wait(lock, [&] { return stop_ || round_ != done; });
+                if (stop_) return;
+                done = round_;
+                task = task_;
+            }
+            (*task)();
+            std::lock_guard<std::mutex> lock(mu_);
+            if (--running_ == 0) done_cv_.notify_one();
+        }
+    }
+
+    std::mutex mu_;  // guards the rest, except workers_
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void()>* task_ = nullptr;
+    uint64_t round_ = 0;
+    size_t running_ = 0;  // workers yet to finish this round
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
+
+// Brings |game| to a state that only depends on what the player has done.
+// challenge.bin leaves each command in |buffer| and its length in saved
+// registers, which would make every state unique: a "look" leaves the same
+// length behind whatever the last command was, and the buffer is cleared.
+// Without a buffer, states that only differ in leftover input stay apart,
+// which costs time but not correctness. Returns what the look printed.
+std::string settle(Game& game, const std::optional<InputBuffer>& buffer) {
+    auto look = game.input("look");
+    if (!buffer) return look;
+    for (uint16_t i = 0; i < buffer->words; i++) {
+        game.vm().poke(buffer->addr + i, 0);
+    }
+    return look;
+}
+
+bool is_alnum(char ch) { return isalnum(static_cast<unsigned char>(ch)); }
+
+// Codes are 12 letters and digits with both cases, standing alone.
+std::vector<std::string> find_codes(std::string_view text) {
+    std::vector<std::string> codes;
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!is_alnum(text[i])) {
+            i++;
+            continue;
+        }
+        size_t j = i;
+        bool upper = false, lower = false;
+        while (j < text.size() && is_alnum(text[j])) {
+            upper |= isupper(static_cast<unsigned char>(text[j])) != 0;
+            lower |= islower(static_cast<unsigned char>(text[j])) != 0;
+            j++;
+        }
+        if (j - i == kCodeLength && upper && lower) {
+            codes.emplace_back(text.substr(i, j - i));
+        }
+        i = j;
+    }
+    return codes;
+}
+
+std::vector<Child> expand(const Node& node,
+                          const std::optional<InputBuffer>& buffer) {
+    const auto& game = *node.game;
+    auto room = Game::parse_room(node.look);
+    auto held = game.fork().inventory();
+
+    std::vector<std::string> cmds;
+    if (room) {
+        cmds = room->exits;
+        for (const auto& item : room->items) cmds.push_back("take " + item);
+    }
+    for (const auto& item : held) cmds.push_back("use " + item);
+
+    std::vector<Child> children;
+    for (auto& cmd : cmds) {
+        Child child{game.fork(), std::move(cmd), "", ""};
+        child.out = child.game->input(child.cmd);
+        if (child.game->state() == Game::State::GameOver) {
+            child.game.reset();
+        } else {
+            child.look = settle(*child.game, buffer);
+        }
+        children.push_back(std::move(child));
+    }
+    return children;
+}
+
+}  // namespace
+
+Exploration explore(const Game& start, size_t max_states, unsigned threads) {
+    auto t0 = std::chrono::steady_clock::now();
+    Exploration result;
+    std::unordered_set<uint64_t> seen;
+    std::unordered_set<std::string> codes;
+    std::vector<Node> nodes;
+
+    // every game explored is forked from this one, on worker threads
+    auto root = start.fork();
+    root.set_perf(nullptr);
+    auto buffer = find_input_buffer(root.vm());
+    auto look = settle(root, buffer);
+    seen.insert(root.vm().state_hash());
+    nodes.push_back({std::move(root), std::move(look), kRoot, ""});
+
+    auto path = [&](size_t i, const std::string& last) {
+        std::vector<std::string> cmds = {last};
+        for (; nodes[i].parent != kRoot; i = nodes[i].parent) {
+            cmds.push_back(nodes[i].cmd);
+        }
+        return std::vector<std::string>(cmds.rbegin(), cmds.rend());
+    };
+
+    Pool pool(std::max(threads, 1u));
+    size_t level = 0;
+    while (level < nodes.size() && result.states < max_states) {
+        size_t end = std::min(nodes.size(), level + max_states - result.states);
+        std::vector<std::vector<Child>> expanded(end - level);
+        std::atomic<size_t> next = level;
+        pool.run([&] {
+            for (size_t i; (i = next++) < end;) {
+                expanded[i - level] = expand(nodes[i], buffer);
+            }
+        });
+
+        // merge in node order, so that the result does not depend on how
+        // the work was split
+        for (size_t i = level; i < end; i++) {
+            result.states++;
+            for (auto& child : expanded[i - level]) {
+                result.commands++;
+                for (auto& code : find_codes(child.out)) {
+                    if (codes.insert(code).second) {
+                        result.codes.emplace_back(code, path(i, child.cmd));
+                    }
+                }
+                auto from = Game::parse_room(nodes[i].look);
+                auto to = Game::parse_room(child.out);
+                if (from && to) {
+                    result.rooms[from->name][child.cmd] = to->name;
+                }
+                if (!child.game) continue;
+                if (!seen.insert(child.game->vm().state_hash()).second) {
+                    continue;
+                }
+                nodes.push_back({std::move(*child.game),
+                                 std::move(child.look), i, child.cmd});
+            }
+            nodes[i].game.reset();
+        }
+        level = end;
+    }
+
+    result.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+    return result;
+}
@@ -0,0 +1,34 @@
+#ifndef EXPLORE_H_
+#define EXPLORE_H_
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "game.h"
+
+struct Exploration {
+    uint64_t states = 0;    // states expanded
+    uint64_t commands = 0;  // commands run, including duplicates
+    double seconds = 0;
+
+    // room -> exit -> room, for every move seen
+    std::map<std::string, std::map<std::string, std::string>> rooms;
+    // codes printed by the game, each with the shortest command sequence
+    // that makes it appear, in the order they were found
+    std::vector<std::pair<std::string, std::vector<std::string>>> codes;
+
+    double rate() const { return seconds > 0 ? states / seconds : 0; }
+};
+
+// Searches the game's states breadth first from |start|. Each state's
+// candidate commands are its room's exits, taking the items there and using
+// the items held; every command runs on a fork of the state, spread across
+// |threads| workers a level at a time. States are deduplicated by the VM's
+// state hash and the search stops after |max_states|.
+Exploration explore(const Game& start, size_t max_states,
+                    unsigned threads = std::thread::hardware_concurrency());
+
+#endif  // EXPLORE_H_
@@ -4,10 +4,47 @@
 #include <iostream>
 #include <stdexcept>
 
+#include "hooks.h"
+
 namespace {
 static constexpr std::string_view kLocationDelimiter = "==";
+
+// Returns the "- item" lines after the first line that starts with |header|
+// and ends with a colon.
+std::vector<std::string> parse_list(std::string_view text,
+                                    std::string_view header) {
+    std::vector<std::string> items;
+    for (auto pos = text.find(header); pos != std::string_view::npos;
+         pos = text.find(header, pos + 1)) {
+        auto end = text.find('\n', pos);
+        if ((pos > 0 && text[pos - 1] != '\n') ||
+            end == std::string_view::npos || text[end - 1] != ':') {
+            continue;
+        }
+        while (text.substr(end + 1, 2) == "- ") {
+            auto next = text.find('\n', end + 1);
+            items.emplace_back(text.substr(end + 3, next - end - 3));
+            end = next;
+        }
+        break;
+    }
+    return items;
+}
+
+class StringSink final : public Sink {
+public:
+    void write(std::string_view line) override { text.append(line); }
+    std::string text;
+};
 }  // namespace
 
+Game::Game(VM vm, Perf* perf, Sink* out) : vm_(std::move(vm)), perf_(perf) {
+    Perf::Phase phase(perf_, "game");
+    install_hooks(vm_);
+    DiscardSink discard;
+    tick(out ? *out : discard);
+}
+
 Game::State Game::state() const {
     switch (vm_.state()) {
         case VM::State::Halt: return State::GameOver;
@@ -26,37 +63,54 @@ std::string Game::loc() {
     return prompt.substr(l + 3, r - l - 4);
 }
 
-std::string Game::tick() {
-    std::string buf;
-    while (true) {
-        vm_.step();
-        switch (vm_.state()) {
-            case VM::State::Halt: {
-                state_ = State::GameOver;
-                return buf;
-            }
-            case VM::State::In: {
-                state_ = State::WaitingForInput;
-                return buf;
-            }
-            case VM::State::Out: {
-                buf.push_back(vm_.output());
-            }
-            case VM::State::Run: {
-                // continue
-            }
-        }
+std::optional<Game::Room> Game::parse_room(std::string_view text) {
+    auto l = text.find(kLocationDelimiter);
+    if (l == std::string_view::npos) return std::nullopt;
+    auto r = text.find(kLocationDelimiter, l + 1);
+    if (r == std::string_view::npos) return std::nullopt;
+    Room room;
+    room.name = text.substr(l + 3, r - l - 4);
+    auto rest = text.substr(r);
+    room.exits = parse_list(rest, "There are ");
+    if (room.exits.empty()) room.exits = parse_list(rest, "There is ");
+    room.items = parse_list(rest, "Things of interest here:");
+    return room;
+}
+
+std::vector<std::string> Game::inventory() {
+    return parse_list(input("inv"), "Your inventory:");
+}
+
+void Game::tick(Sink& out) {
+    VM::State state;
+    do {
+        line_.clear();
+        state = vm_.run_until(VM::Event::Line, line_);
+        if (!line_.empty()) out.write(line_);
+    } while (state == VM::State::Run);
+    switch (state) {
+        case VM::State::Halt: state_ = State::GameOver; break;
+        case VM::State::In: state_ = State::WaitingForInput; break;
+        case VM::State::Out:
+        case VM::State::Run: assert(false);
     }
-    return buf;
+    out.flush();
 }
 
 std::string Game::input(std::string_view cmd) {
-    int i = 0;
-    for (; i < cmd.size() && vm_.state() == VM::State::In; i++) {
-        vm_.input(cmd[i]);
-        tick();
-    }
-    if (i != cmd.size()) std::cerr << "warn: vm did not read entire command\n";
+    StringSink out;
+    input(cmd, out);
+    return std::move(out.text);
+}
+
+void Game::input(std::string_view cmd, Sink& out) {
+    // only build the phase name when it is measured
+    Perf::Phase phase(perf_,
+                      perf_ ? "input: " + std::string(cmd) : std::string());
+    vm_.input(cmd);
     vm_.input('\n');
-    return tick();
+    tick(out);
+    if (vm_.pending_input() > 0) {
+        std::cerr << "warn: vm did not read entire command\n";
+    }
 }
@@ -7,6 +7,8 @@
 #include <variant>
 #include <vector>
 
+#include "perf.h"
+#include "sink.h"
 #include "vm.h"
 
 class Game {
@@ -16,17 +18,45 @@ public:
         GameOver,
     };
 
-    Game(std::vector<uint16_t> program) : vm_(program) { tick(); }
+    // What a room description lists, as printed on arrival or by "look".
+    struct Room {
+        std::string name;
+        std::vector<std::string> exits;
+        std::vector<std::string> items;
+    };
+
+    // Runs |vm| to its first prompt: for a fresh program, through the
+    // self-test and decryption prelude, whose output goes to |out| if set.
+    // With |perf|, that and each command are measured as phases.
+    Game(VM vm, Perf* perf = nullptr, Sink* out = nullptr);
+    Game(std::vector<uint16_t> program, VM::Options options = {},
+         Perf* perf = nullptr)
+        : Game(VM(std::move(program), options), perf) {}
     State state() const;
 
     std::string loc();
+    // Returns the room described in |text|, if there is one.
+    static std::optional<Room> parse_room(std::string_view text);
+    std::vector<std::string> inventory();
+    // Runs |cmd| and returns what the game printed in response.
     std::string input(std::string_view cmd);
+    // Runs |cmd|, streaming the response to |out| as it is printed.
+    void input(std::string_view cmd, Sink& out);
     void set_8th_reg(uint16_t val) { vm_.set_reg(7, val); }
+    VM& vm() { return vm_; }
+    const VM& vm() const { return vm_; }
+    // A copy of the game that shares the VM's memory until either writes.
+    Game fork() const { return *this; }
+    // Perf isn't thread-safe, so forks run on other threads clear it.
+    void set_perf(Perf* perf) { perf_ = perf; }
+    void save(const std::string& path) const { vm_.save_image(path); }
 
 private:
-    std::string tick();
+    void tick(Sink& out);
 
     VM vm_;
+    std::string line_;  // reused for every line of output
+    Perf* perf_;
     State state_;
     std::string prompt_;
 };
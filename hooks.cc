@@ -0,0 +1,32 @@
+#include "hooks.h"
+
+#include "ackermann.h"
+
+static constexpr uint16_t kConfirmation = 6027;
+
+// "set r0 <max length>; set r1 <buffer>; call 1767", the command prompt's
+// call to the line reader
+static constexpr uint16_t kReadCommand = 2818;
+static constexpr uint16_t kReadLine = 1767;
+
+void install_hooks(VM& vm) {
+    // the evaluator's tables only live for one call, so that forks copy
+    // an empty hook rather than 128KB of rows
+    vm.set_hook(kConfirmation, [](VM& vm) {
+        Ackermann ack;
+        vm.set_reg(0, ack(vm.reg(0), vm.reg(1), vm.reg(7)));
+        vm.set_pc(vm.pop());
+    });
+}
+
+std::optional<InputBuffer> find_input_buffer(const VM& vm) {
+    auto word = [&](uint16_t i) { return vm.peek(kReadCommand + i); };
+    auto set = static_cast<uint16_t>(Opcode::Set);
+    auto call = static_cast<uint16_t>(Opcode::Call);
+    if (word(0) != set || word(1) != kMaxInt || word(3) != set ||
+        word(4) != kMaxInt + 1 || word(6) != call || word(7) != kReadLine ||
+        word(2) >= kMaxInt || word(5) >= kMaxInt - word(2)) {
+        return std::nullopt;
+    }
+    return InputBuffer{word(5), static_cast<uint16_t>(word(2) + 1)};
+}
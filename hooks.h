@@ -0,0 +1,26 @@
+#ifndef HOOKS_H_
+#define HOOKS_H_
+
+#include <optional>
+
+#include "vm.h"
+
+// Installs native replacements for routines in challenge.bin that are too
+// slow to interpret: currently the teleporter's confirmation routine at
+// 6027, which computes f(r0, r1) (see ackermann.h) into r0. Only r0 is
+// defined after the bytecode version returns, so the hook leaves the other
+// registers alone.
+void install_hooks(VM& vm);
+
+// Where challenge.bin reads each command: a length word and then the
+// characters, left in place after the command has run.
+struct InputBuffer {
+    uint16_t addr;
+    uint16_t words;  // the length word included
+};
+
+// Finds the buffer from the call that reads commands into it, once the
+// prelude has decrypted the game. Returns nothing for other programs.
+std::optional<InputBuffer> find_input_buffer(const VM& vm);
+
+#endif  // HOOKS_H_
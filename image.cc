@@ -0,0 +1,164 @@
+// VM::save_image, VM::load_image and program loading.
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "mapping.h"
+#include "vm.h"
+
+namespace {
+
+// Followed by memory and registers (kMaxInt + kNumReg words), the stack
+// (stack_words) and pending input (input_bytes), all in host byte order.
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t mem_words;
+    uint32_t stack_words;
+    uint32_t input_bytes;
+    uint16_t pc;
+    uint8_t state;
+    char out;
+};
+
+static constexpr char kMagic[8] = {'S', 'Y', 'N', 'I', 'M', 'A', 'G', 'E'};
+static constexpr uint32_t kVersion = 1;
+
+// Decodes |n| little-endian words from |bytes| into |out| and returns the
+// largest, so that the range check needs no second pass over memory.
+uint16_t decode_words(const char* bytes, size_t n, uint16_t* out) {
+    if constexpr (std::endian::native == std::endian::little) {
+        memcpy(out, bytes, n * sizeof(uint16_t));
+    } else {
+        // vectorizes into byte shuffles
+        for (size_t i = 0; i < n; i++) {
+            uint16_t word;
+            memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+            out[i] = static_cast<uint16_t>(word >> 8 | word << 8);
+        }
+    }
+    uint16_t max = 0;
+    for (size_t i = 0; i < n; i++) max = std::max(max, out[i]);
+    return max;
+}
+
+// Maps the program at |path| and checks that it fits in memory.
+size_t program_words(const MappedFile& file, const std::string& path) {
+    if (file.size() % sizeof(uint16_t) != 0) {
+        throw std::runtime_error(path + ": odd number of bytes");
+    }
+    size_t words = file.size() / sizeof(uint16_t);
+    if (words > kMaxInt) {
+        throw std::runtime_error(path + ": program too large: " +
+                                 std::to_string(words) + " words");
+    }
+    file.advise(MADV_SEQUENTIAL);
+    return words;
+}
+
+// Throws unless every word in |words| is a number or a register, given
+// that |max| is the largest of them.
+void check_words(const std::string& path, const uint16_t* words, size_t n,
+                 size_t base, uint16_t max) {
+    if (max < kMaxInt + kNumReg) return;
+    size_t i = std::find_if(words, words + n, [](uint16_t word) {
+        return word >= kMaxInt + kNumReg;
+    }) - words;
+    throw std::runtime_error(path + ": invalid word " +
+                             std::to_string(words[i]) + " at " +
+                             std::to_string(base + i));
+}
+
+}  // namespace
+
+std::vector<uint16_t> read_program(const std::string& path) {
+    MappedFile file(path);
+    std::vector<uint16_t> program(program_words(file, path));
+    auto max = decode_words(file.data(), program.size(), program.data());
+    check_words(path, program.data(), program.size(), 0, max);
+    return program;
+}
+
+VM VM::load_program(const std::string& path, Options options) {
+    MappedFile file(path);
+    size_t words = program_words(file, path);
+    VM vm({}, options);
+    for (size_t i = 0; i < words; i += kPageSize) {
+        auto n = std::min<size_t>(kPageSize, words - i);
+        auto* page = vm.mem_[i >> kPageBits].mut().data();
+        auto max = decode_words(file.data() + i * sizeof(uint16_t), n, page);
+        check_words(path, page, n, i, max);
+    }
+    vm.rehash();
+    return vm;
+}
+
+void VM::save_image(const std::string& path) const {
+    auto input = std::string_view(in_).substr(in_pos_);
+    Header header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.mem_words = kMaxInt + kNumReg;
+    header.stack_words = stack_.size();
+    header.input_bytes = input.size();
+    header.pc = pc_;
+    header.state = static_cast<uint8_t>(state_);
+    header.out = out_;
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (f == nullptr) throw sys_error(path);
+    fwrite(&header, sizeof(header), 1, f);
+    for (const auto& page : mem_) fwrite(page->data(), sizeof(MemPage), 1, f);
+    fwrite(regs_.data(), sizeof(regs_[0]), regs_.size(), f);
+    fwrite(stack_.data(), sizeof(stack_[0]), stack_.size(), f);
+    fwrite(input.data(), 1, input.size(), f);
+    bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok) throw sys_error(path);
+}
+
+VM VM::load_image(const std::string& path, Options options) {
+    MappedFile file(path);
+    Header header{};
+    if (file.size() >= sizeof(header)) {
+        memcpy(&header, file.data(), sizeof(header));
+    }
+    size_t size = sizeof(header) + header.mem_words * sizeof(uint16_t) +
+                  uint64_t(header.stack_words) * sizeof(uint16_t) +
+                  header.input_bytes;
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion || header.mem_words != kMaxInt + kNumReg ||
+        header.state > static_cast<uint8_t>(State::In) ||
+        header.pc >= kMaxInt || file.size() != size) {
+        throw std::runtime_error(path + ": not a valid image");
+    }
+
+    VM vm({}, options);
+    const char* p = file.data() + sizeof(header);
+    for (auto& page : vm.mem_) {
+        memcpy(page.mut().data(), p, sizeof(MemPage));
+        p += sizeof(MemPage);
+    }
+    memcpy(vm.regs_.data(), p, sizeof(vm.regs_));
+    p += sizeof(vm.regs_);
+    vm.stack_.resize(header.stack_words);
+    memcpy(vm.stack_.data(), p, header.stack_words * sizeof(uint16_t));
+    p += header.stack_words * sizeof(uint16_t);
+    vm.in_.assign(p, header.input_bytes);
+    vm.pc_ = header.pc;
+    vm.state_ = static_cast<State>(header.state);
+    vm.out_ = header.out;
+    vm.rehash();
+    return vm;
+}
+
+bool VM::is_image(const std::string& path) {
+    std::ifstream is(path, std::ios::binary);
+    char magic[sizeof(kMagic)] = {};
+    is.read(magic, sizeof(magic));
+    return is.good() && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
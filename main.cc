@@ -1,276 +1,480 @@
+#include <unistd.h>
+
+#include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <set>
-#include <variant>
+#include <thread>
 #include <vector>
 
+#include "cfg.h"
+#include "conform.h"
+#include "driver.h"
+#include "explore.h"
 #include "game.h"
+#include "hooks.h"
+#include "mapping.h"
+#include "orb.h"
+#include "perf.h"
+#include "profile.h"
+#include "replay.h"
+#include "server.h"
+#include "sink.h"
+#include "teleporter.h"
+#include "trace.h"
+#include "translate.h"
 
 using namespace std;
 
+// Set by PERF_REPORT=<path> to measure the phases of a run.
+static Perf* perf = nullptr;
+
 void die(string_view msg) {
     cerr << msg << endl;
     exit(1);
 }
 
-vector<uint16_t> read_program(istream& is) {
-    vector<uint16_t> program;
-    uint16_t lo, hi;
-    while (is.good()) {
-        lo = is.get();
-        if (!is.good()) break;
-        hi = is.get();
-        if (!is.good()) break;
-        program.push_back(lo + (hi << 8));
+// REG8_BACKEND=scalar|avx2|avx512 overrides the fastest backend the CPU
+// supports.
+AckermannBackend reg8_backend() {
+    auto backend = best_backend();
+    if (const char* name = getenv("REG8_BACKEND")) {
+        if (!parse_backend(name, backend)) die("unknown REG8_BACKEND");
+        if (!supported(backend)) die("REG8_BACKEND not supported by this cpu");
     }
-    if (!is.eof()) die("error reading input file");
-    return program;
+    return backend;
 }
 
-using Memo = std::array<std::array<std::optional<uint16_t>, kMaxInt>, 5>;
+uint16_t compute_reg8() {
+    Perf::Phase phase(perf, "compute_reg8");
+    auto backend = reg8_backend();
+    auto search = search_reg8(std::thread::hardware_concurrency(), backend);
+    assert(search.r7.has_value());
+    std::cout << "checked " << search.checked << " candidates with "
+              << to_string(backend) << " in " << search.seconds << "s ("
+              << static_cast<uint64_t>(search.rate()) << "/s)" << std::endl;
+    return *search.r7;
+}
 
-uint16_t verify_reg8(uint16_t r0, uint16_t r1, uint16_t r7, Memo& memo) {
-    /*
-    [    6027] JT r0 6035
-    [    6030] ADD r0 r1 1
-    [    6034] RET
-    [    6035] JT r1 6048
-    [    6038] ADD r0 r0 32767
-    [    6042] SET r1 r7
-    [    6045] CALL 6027
-    [    6047] RET
-    [    6048] PUSH r0
-    [    6050] ADD r1 r1 32767
-    [    6054] CALL 6027
-    [    6056] SET r1 r0
-    [    6059] POP r0
-    [    6061] ADD r0 r0 32767
-    [    6065] CALL 6027
-    [    6067] RET
-    */
+std::vector<Dir> solve_orb_path(const Game& game) {
+    Perf::Phase phase(perf, "solve_orb_path");
+    printf("finding orb path...\n");
+    auto grid = map_orb_grid(game);
+    if (!grid) die("could not map the vault grid");
+    auto path = solve_orb(*grid);
+    if (!path) die("no path opens the vault");
+    printf("path in %lu\n", path->steps.size());
+    return path->steps;
+}
 
-    assert(r0 < 5);
-    assert(r1 < kMaxInt);
-    if (r0 == 0) return (r1 + 1) % kMaxInt;
-    if (auto val = memo[r0][r1]; val.has_value()) return *val;
-    if (r1 > 0) {
-        uint16_t y = verify_reg8(r0, (r1 + 32767) % kMaxInt, r7, memo);
-        uint16_t x = verify_reg8((r0 + 32767) % kMaxInt, y, r7, memo);
-        memo[r0][r1] = x;
-        return x;
-    } else {
-        uint16_t x = verify_reg8((r0 + 32767) % kMaxInt, r7, r7, memo);
-        memo[r0][r1] = x;
-        return x;
-    }
+// Plays through to the end, as a driver for drive().
+Driver play(Game& game) {
+    co_await command("take tablet");
+    co_await command("use tablet");
+    co_await command("doorway");
+    co_await command("north");
+    co_await command("north");
+    co_await command("bridge");
+    co_await command("continue");
+    co_await command("down");
+    co_await command("east");
+    co_await command("take empty lantern");
+    co_await command("west");
+    co_await command("west");
+    co_await command("passage");
+    co_await command("ladder");
+    co_await command("west");
+    co_await command("north");
+    co_await command("north");
+    co_await command("south");
+    co_await command("north");
+    co_await command("take can");
+    co_await command("west");
+    co_await command("ladder");
+    co_await command("darkness");
+    co_await command("use can");
+    co_await command("use lantern");
+    co_await command("continue");
+    co_await command("west");
+    co_await command("west");
+    co_await command("west");
+    co_await command("west");
+    co_await command("north");
+    co_await command("take red coin");
+    co_await command("north");
+    co_await command("west");
+    co_await command("take blue coin");
+    co_await command("up");
+    co_await command("take shiny coin");
+    co_await command("down");
+    co_await command("east");
+    co_await command("east");
+    co_await command("take concave coin");
+    co_await command("down");
+    co_await command("take corroded coin");
+    co_await command("up");
+    co_await command("west");
+    co_await command("use blue coin");
+    co_await command("use red coin");
+    co_await command("use shiny coin");
+    co_await command("use concave coin");
+    co_await command("use corroded coin");
+    co_await command("north");
+    co_await command("take teleporter");
+    co_await command("use teleporter");
+    co_await command("take business card");
+    co_await command("take strange book");
+    std::cout << "computing teleporter register..." << std::endl;
+    auto val = compute_reg8();
+    std::cout << "teleporter register: " << val << std::endl;
+    game.set_8th_reg(val);
+    co_await command("use teleporter");
+    co_await command("north");
+    co_await command("north");
+    co_await command("north");
+    co_await command("north");
+    co_await command("north");
+    co_await command("north");
+    co_await command("north");
+    co_await command("east");
+    co_await command("take journal");
+    co_await command("west");
+    co_await command("north");
+    co_await command("north");
+    co_await command("take orb");
+    for (auto dir : solve_orb_path(game)) co_await command(to_string(dir));
+    co_await command("vault");
+    co_await command("take mirror");
+    std::cout << co_await command("use mirror") << std::endl;
 }
 
-uint16_t compute_reg8() {
-    for (uint16_t r7 = 0; r7 < kMaxInt; r7++) {
-        Memo memo;
-        auto result = verify_reg8(4, 1, r7, memo);
-        if (result == 6) return r7;
+// Loads a snapshot image, or a program that starts from the beginning.
+VM load(const char* path, VM::Options options) {
+    if (VM::is_image(path)) {
+        Perf::Phase phase(perf, "load_image");
+        return VM::load_image(path, options);
     }
-    assert(false);
+    Perf::Phase phase(perf, "load_program");
+    return VM::load_program(path, options);
 }
 
-using pt = std::pair<int, int>;
-enum class Dir { North, South, East, West };
+void run(const char* path, VM::Options options) {
+    Game game(load(path, options), perf);
+    DiscardSink discard;
+    drive(game, play(game), discard);
+}
 
-pt dir_to_d(Dir dir) {
-    switch (dir) {
-        case Dir::North: return {1, 0};
-        case Dir::South: return {-1, 0};
-        case Dir::East: return {0, 1};
-        case Dir::West: return {0, -1};
+// Plays commands read from stdin, printing the game's output as it goes.
+void interactive(const char* path, VM::Options options) {
+    FdSink out(STDOUT_FILENO);
+    Game game(load(path, options), perf, &out);
+    string cmd;
+    while (game.state() == Game::State::WaitingForInput && getline(cin, cmd)) {
+        game.input(cmd, out);
     }
 }
 
-int dist(int row1, int col1, int row2, int col2) {
-    int dr = row2 - row1;
-    int dc = col2 - col1;
-    return (dr > 0 ? dr : -dr) + (dc > 0 ? dc : -dc);
+static constexpr char kFoldedPath[] = "profile.folded";
+
+// Plays through as run does while counting instructions, then prints where
+// they went and writes collapsed stacks for flamegraph tools.
+void profile(const char* path, VM::Options options) {
+    options.profile = make_shared<Profile>();
+    Game game(load(path, options), perf);
+    DiscardSink discard;
+    drive(game, play(game), discard);
+    cout << endl;
+    options.profile->report(stdout, game.vm());
+    FILE* f = fopen(kFoldedPath, "w");
+    if (f == nullptr) die(strerror(errno));
+    options.profile->write_folded(f);
+    fclose(f);
+    printf("\ncollapsed stacks written to %s\n", kFoldedPath);
 }
 
-using tile = std::variant<int, char>;
+// Saves the game at its first prompt, so that later runs skip the prelude.
+void snapshot(const char* path, const char* out, VM::Options options) {
+    Game game(load(path, options), perf);
+    game.save(out);
+}
 
-static std::array<std::array<tile, 4>, 4> kGrid{
-    std::array<tile, 4>{22, '-', 9, '*'},
-    std::array<tile, 4>{'+', 4, '-', 18},
-    std::array<tile, 4>{4, '*', 11, '*'},
-    std::array<tile, 4>{'*', 8, '-', 1},
-};
+// Translates the program as it stands at its first prompt, once the
+// self-test and decryption prelude has run in the interpreter.
+void compile(const char* path, VM::Options options) {
+    VM vm = load(path, options);
+    install_hooks(vm);
+    string out;
+    vm.run(out);
+    translate(vm, out, cout);
+}
 
-constexpr int kTarget = 30;
-constexpr int kStart = 22;
+// Prints the control flow graph of the program as it stands at its first
+// prompt, as a block listing or, with |format| "dot", for graphviz. With
+// |mode| "static", the program isn't run and the graph starts at address 0
+// of the image as loaded, which for a binary is still encrypted past the
+// prelude.
+void print_cfg(const char* path, const char* format, const char* mode,
+               VM::Options options) {
+    auto cfg_format = CfgFormat::Text;
+    if (format && format == string("dot")) {
+        cfg_format = CfgFormat::Dot;
+    } else if (format && format != string("text")) {
+        die("cfg format must be text or dot");
+    }
+    bool is_static = mode && mode == string("static");
+    if (mode && !is_static && mode != string("live")) {
+        die("cfg mode must be live or static");
+    }
+    VM vm = load(path, options);
+    string out;
+    if (!is_static) {
+        install_hooks(vm);
+        vm.run(out);
+    }
+    vector<uint16_t> mem(kMaxInt);
+    for (size_t i = 0; i < mem.size(); i++) mem[i] = vm.peek(i);
+    Cfg cfg;
+    {
+        Perf::Phase phase(perf, "recover_cfg");
+        cfg = recover_cfg(mem, is_static ? vector<uint16_t>{0}
+                                         : live_entries(vm));
+    }
+    out.clear();
+    format_cfg(cfg, mem, cfg_format, out);
+    write_all(STDOUT_FILENO, out);
+}
 
-static std::pair<Dir, std::array<Dir, 3>> kMoves[] = {
-    {Dir::North, {Dir::North, Dir::East, Dir::West}},
-    {Dir::South, {Dir::South, Dir::East, Dir::West}},
-    {Dir::East, {Dir::East, Dir::North, Dir::South}},
-    {Dir::West, {Dir::West, Dir::North, Dir::South}},
-};
+// Replays each script on a fork of one loaded VM, so an image is read once
+// however many scripts run. Returns how many scripts failed.
+int run_scripts(const char* path, vector<string> script_paths,
+                VM::Options options) {
+    // the trace and profile sinks are not shared across threads
+    options.trace_file = nullptr;
+    options.profile = nullptr;
+    vector<Script> scripts;
+    for (const auto& script : script_paths) {
+        scripts.push_back(read_script(script));
+    }
+    VM vm = load(path, options);
+    install_hooks(vm);
+    vector<Replay> results;
+    {
+        Perf::Phase phase(perf, "replay");
+        results = replay_all(vm, scripts);
+    }
+    int failed = 0;
+    for (size_t i = 0; i < scripts.size(); i++) {
+        const auto& result = results[i];
+        for (const auto& failure : result.failures) {
+            printf("FAIL %s\n", failure.c_str());
+        }
+        failed += !result.failures.empty();
+        printf("%s: %s, %lu commands%s\n", scripts[i].path.c_str(),
+               result.failures.empty() ? "ok" : "failed", result.commands,
+               result.game_over ? ", game over" : "");
+    }
+    printf("%lu scripts, %d failed\n", scripts.size(), failed);
+    return failed;
+}
 
-int apply(int base, char op, int val) {
-    switch (op) {
-        case '+': return base + val;
-        case '*': return base * val;
-        case '-': return base - val;
+// Hosts game sessions that all start from the program or image, over
+// stdin and stdout or, given |socket|, on a Unix socket.
+void serve(const char* path, const char* socket, VM::Options options) {
+    // the trace and profile sinks are not shared across threads
+    options.trace_file = nullptr;
+    options.profile = nullptr;
+    VM vm = load(path, options);
+    install_hooks(vm);
+    if (socket) {
+        serve_socket(std::move(vm), socket);
+        return;
     }
-    assert(false);
+    Server::Stats stats;
+    {
+        Perf::Phase phase(perf, "serve");
+        stats = serve_lines(std::move(vm), cin, stdout);
+    }
+    fprintf(stderr, "%lu sessions, %lu slices, %lu steals\n", stats.sessions,
+            stats.slices, stats.steals);
 }
 
-using Step = std::pair<Dir, int>;
+static constexpr size_t kConformPrograms = 2000;
+static constexpr size_t kConformTranslated = 8;
 
-bool path_exists(int row, int col, int sum, int steps,
-                 std::vector<Step>& path) {
-    if (row == 3 && col == 3) return sum == kTarget;
-    if (steps <= 0) return false;
-    for (const auto& [step1, step2s] : kMoves) {
-        for (const auto step2 : step2s) {
-            auto [dr1, dc1] = dir_to_d(step1);
-            auto [dr2, dc2] = dir_to_d(step2);
-            auto next_row = row + dr1 + dr2;
-            auto next_col = col + dc1 + dc2;
-            if (dist(next_row, next_col, 3, 3) > steps) continue;
-            if (next_row < 0 || next_row > 3 || next_col < 0 || next_col > 3) {
-                continue;
-            }
-            if (next_row == 0 && next_col == 0) continue;
-            char op = std::get<char>(kGrid[row + dr1][col + dc1]);
-            int val = std::get<int>(kGrid[next_row][next_col]);
-            int next_sum = apply(sum, op, val);
-            if (next_sum <= 0) continue;
-            path.push_back({step1, sum});
-            path.push_back({step2, next_sum});
-            if (path_exists(next_row, next_col, next_sum, steps - 2, path)) {
-                return true;
-            }
-            path.pop_back();
-            path.pop_back();
-        }
+// The program itself is checked with these commands queued, for at most
+// kConformSteps instructions.
+static constexpr char kConformInput[] = "take tablet\nuse tablet\nlook\n";
+static constexpr uint64_t kConformSteps = 20000000;
+static constexpr uint64_t kConformInterval = 1 << 16;
+
+void print_divergence(const Divergence& d) {
+    printf("DIVERGED %s: %s\n", d.engine.c_str(), d.what.c_str());
+    printf("  input:");
+    for (unsigned char ch : d.input) printf(" %u", ch);
+    printf("\n  program:");
+    for (auto word : d.program) printf(" %u", word);
+    printf("\n");
+    string listing;
+    try {
+        disasm(d.program, listing);
+    } catch (const exception&) {
+        // invalid operands; the words above are exact anyway
     }
-    return false;
+    printf("%s\n", listing.c_str());
 }
 
-std::string solve_orb_path(Game& game) {
-    printf("finding orb path...\n");
-    std::vector<Step> path;
-    bool exists = false;
-    // i found a path manually in 16 steps that took too long, so we need
-    // one shorter than that
-    for (int steps = 6; steps <= 14; steps += 2) {
-        if (path_exists(0, 0, kStart, steps, path)) {
-            exists = true;
-            break;
-        }
+// Checks the VM's execution engines against a reference interpreter on
+// edge cases, random programs and then the program itself. Returns whether
+// any diverged. CONFORM_PROGRAMS=<n> and CONFORM_SEED=<n> pick the random
+// programs. CONFORM_BUILD=<compiler command> also checks the translation
+// to C++ of the edge cases and CONFORM_TRANSLATED=<n> random programs.
+bool conform(const char* path) {
+    size_t programs = kConformPrograms;
+    uint64_t seed = 1;
+    if (const char* n = getenv("CONFORM_PROGRAMS")) {
+        programs = strtoul(n, nullptr, 10);
+    }
+    if (const char* s = getenv("CONFORM_SEED")) seed = strtoull(s, nullptr, 10);
+    auto program = read_program(path);
+    ConformResult result;
+    optional<Divergence> own;
+    {
+        Perf::Phase phase(perf, "conform");
+        result = conform_random(seed, programs);
+        own = conform(program, kConformInput, kConformSteps,
+                      kConformInterval);
     }
-    assert(exists);
-    printf("path in %lu\n", path.size());
-    std::string last;
-    for (auto [dir, sum] : path) {
-        switch (dir) {
-            case Dir::North: last = game.input("north"); break;
-            case Dir::South: last = game.input("south"); break;
-            case Dir::East: last = game.input("east"); break;
-            case Dir::West: last = game.input("west"); break;
+    for (const auto& d : result.divergences) print_divergence(d);
+    if (own) print_divergence(*own);
+    printf("%lu random and edge-case programs, %lu instructions: %lu "
+           "diverged\n%s: %s\n",
+           result.programs, result.instructions, result.divergences.size(),
+           path, own ? "diverged" : "ok");
+    bool failed = own || !result.divergences.empty();
+    if (const char* build = getenv("CONFORM_BUILD")) {
+        size_t translated = kConformTranslated;
+        if (const char* n = getenv("CONFORM_TRANSLATED")) {
+            translated = strtoul(n, nullptr, 10);
         }
+        Perf::Phase phase(perf, "conform_translated");
+        auto result = conform_translated(seed, translated, build);
+        for (const auto& d : result.divergences) print_divergence(d);
+        printf("%lu translated programs: %lu diverged\n", result.programs,
+               result.divergences.size());
+        failed |= !result.divergences.empty();
     }
-    return last;
+    return failed;
 }
 
-void play(Game& game) {
-    game.input("take tablet");
-    game.input("use tablet");
-    game.input("doorway");
-    game.input("north");
-    game.input("north");
-    game.input("bridge");
-    game.input("continue");
-    game.input("down");
-    game.input("east");
-    game.input("take empty lantern");
-    game.input("west");
-    game.input("west");
-    game.input("passage");
-    game.input("ladder");
-    game.input("west");
-    game.input("north");
-    game.input("north");
-    game.input("south");
-    game.input("north");
-    game.input("take can");
-    game.input("west");
-    game.input("ladder");
-    game.input("darkness");
-    game.input("use can");
-    game.input("use lantern");
-    game.input("continue");
-    game.input("west");
-    game.input("west");
-    game.input("west");
-    game.input("west");
-    game.input("north");
-    game.input("take red coin");
-    game.input("north");
-    game.input("west");
-    game.input("take blue coin");
-    game.input("up");
-    game.input("take shiny coin");
-    game.input("down");
-    game.input("east");
-    game.input("east");
-    game.input("take concave coin");
-    game.input("down");
-    game.input("take corroded coin");
-    game.input("up");
-    game.input("west");
-    game.input("use blue coin");
-    game.input("use red coin");
-    game.input("use shiny coin");
-    game.input("use concave coin");
-    game.input("use corroded coin");
-    game.input("north");
-    game.input("take teleporter");
-    game.input("use teleporter");
-    game.input("take business card");
-    game.input("take strange book");
-    std::cout << "computing teleporter register..." << std::endl;
-    auto val = compute_reg8();
-    std::cout << "teleporter register: " << val << std::endl;
-    game.set_8th_reg(val);
-    game.input("use teleporter");
-    game.input("north");
-    game.input("north");
-    game.input("north");
-    game.input("north");
-    game.input("north");
-    game.input("north");
-    game.input("north");
-    game.input("east");
-    game.input("take journal");
-    game.input("west");
-    game.input("north");
-    game.input("north");
-    game.input("take orb");
-    solve_orb_path(game);
-    game.input("vault");
-    game.input("take mirror");
-    std::cout << game.input("use mirror") << std::endl;
-}
+static constexpr size_t kExploreMaxStates = 20000;
 
-void run(vector<uint16_t> program) {
-    Game game(program);
-    play(game);
+// Walks the game world from its first prompt and prints the rooms found and
+// the codes printed along the way. EXPLORE_MAX_STATES=<n> bounds the search.
+void explore(const char* path, VM::Options options) {
+    // the trace and profile sinks are not shared across threads
+    options.trace_file = nullptr;
+    options.profile = nullptr;
+    Game game(load(path, options), perf);
+    size_t max_states = kExploreMaxStates;
+    if (const char* max = getenv("EXPLORE_MAX_STATES")) {
+        max_states = strtoul(max, nullptr, 10);
+    }
+    Exploration result;
+    {
+        Perf::Phase phase(perf, "explore");
+        result = explore(game, max_states);
+    }
+    printf("%lu states, %lu commands in %.2fs (%.0f states/s)\n",
+           result.states, result.commands, result.seconds, result.rate());
+    printf("\nrooms:\n");
+    for (const auto& [room, exits] : result.rooms) {
+        printf("  %s\n", room.c_str());
+        for (const auto& [exit, to] : exits) {
+            printf("    %s -> %s\n", exit.c_str(), to.c_str());
+        }
+    }
+    printf("\ncodes:\n");
+    for (const auto& [code, cmds] : result.codes) {
+        printf("  %s:", code.c_str());
+        for (const auto& cmd : cmds) printf(" %s;", cmd.c_str());
+        printf("\n");
+    }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) die("usage: synacorpp <cmd> <bin>\ncommands: run, disasm\n");
-    ifstream is(argv[2]);
-    if (!is.good()) die(strerror(errno));
-    auto program = read_program(is);
-    if (argv[1] == string("run")) run(program);
-    if (argv[1] == string("disasm")) disasm(program);
-    return 0;
+    string cmd = argc > 1 ? argv[1] : "";
+    int min_args = 3, max_args = 3;
+    if (cmd == "snapshot") min_args = max_args = 4;
+    if (cmd == "replay") min_args = 4, max_args = argc;
+    if (cmd == "serve") max_args = 4;
+    if (cmd == "cfg") max_args = 5;
+    if (argc < min_args || argc > max_args) {
+        die("usage: synacorpp <cmd> <file> [<args>]\n"
+            "commands:\n"
+            "  run <bin|image>\n"
+            "  play <bin|image>\n"
+            "  profile <bin|image>\n"
+            "  snapshot <bin|image> <image>\n"
+            "  replay <bin|image> <script>...\n"
+            "  compile <bin|image>\n"
+            "  cfg <bin|image> [text|dot] [live|static]\n"
+            "  explore <bin|image>\n"
+            "  serve <bin|image> [<socket>]\n"
+            "  disasm <bin>\n"
+            "  conform <bin>\n"
+            "  trace-dump <trace>\n");
+    }
+    bool failed = false;
+    try {
+        if (argv[1] == string("trace-dump")) {
+            dump_trace(argv[2], stdout);
+            return 0;
+        }
+        unique_ptr<Perf> perf_phases;
+        const char* perf_path = getenv("PERF_REPORT");
+        if (perf_path) {
+            perf_phases = make_unique<Perf>();
+            perf = perf_phases.get();
+        }
+        // TRACE=1 prints every instruction to stderr, TRACE_FILE=<path>
+        // records them in binary for trace-dump; CHECKED=1 reports bad
+        // addresses and division by zero
+        VM::Options options;
+        options.trace = getenv("TRACE") != nullptr;
+        options.checked = getenv("CHECKED") != nullptr;
+        if (const char* path = getenv("TRACE_FILE")) {
+            options.trace_file = make_shared<TraceWriter>(path);
+        }
+        if (argv[1] == string("run")) run(argv[2], options);
+        if (argv[1] == string("play")) interactive(argv[2], options);
+        if (argv[1] == string("profile")) profile(argv[2], options);
+        if (argv[1] == string("snapshot")) snapshot(argv[2], argv[3], options);
+        if (argv[1] == string("disasm")) disasm(read_program(argv[2]));
+        if (argv[1] == string("conform")) failed = conform(argv[2]);
+        if (argv[1] == string("compile")) compile(argv[2], options);
+        if (argv[1] == string("cfg")) {
+            print_cfg(argv[2], argc > 3 ? argv[3] : nullptr,
+                      argc > 4 ? argv[4] : nullptr, options);
+        }
+        if (argv[1] == string("explore")) explore(argv[2], options);
+        if (argv[1] == string("serve")) {
+            serve(argv[2], argc > 3 ? argv[3] : nullptr, options);
+        }
+        if (argv[1] == string("replay")) {
+            vector<string> scripts(argv + 3, argv + argc);
+            failed = run_scripts(argv[2], scripts, options) > 0;
+        }
+        if (perf_path) {
+            ofstream os(perf_path);
+            perf->write_json(os);
+            if (!os.good()) die(strerror(errno));
+        }
+    } catch (const exception& e) {
+        die(e.what());
+    }
+    return failed ? 1 : 0;
 }
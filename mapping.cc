@@ -0,0 +1,57 @@
+#include "mapping.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+std::runtime_error sys_error(const std::string& what) {
+    return std::runtime_error(what + ": " + strerror(errno));
+}
+
+void write_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t n = write(fd, data.data(), data.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw sys_error("write");
+        data.remove_prefix(n);
+    }
+}
+
+Mapping::Mapping(int fd, uint64_t offset, size_t len, int prot) {
+    static const uint64_t kPage = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(kPage - 1);
+    len_ = len + (offset - start);
+    addr_ = mmap(nullptr, len_, prot, MAP_SHARED, fd, start);
+    if (addr_ == MAP_FAILED) throw sys_error("mmap");
+    data_ = static_cast<char*>(addr_) + (offset - start);
+}
+
+Mapping::~Mapping() { munmap(addr_, len_); }
+
+void Mapping::advise(int advice) const { madvise(addr_, len_, advice); }
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw sys_error(path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        auto err = sys_error(path);
+        close(fd);
+        throw err;
+    }
+    size_ = st.st_size;
+    try {
+        // the mapping stays valid after the descriptor is closed
+        if (size_ > 0) {
+            map_ = std::make_unique<Mapping>(fd, 0, size_, PROT_READ);
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+}
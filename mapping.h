@@ -0,0 +1,53 @@
+#ifndef MAPPING_H_
+#define MAPPING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// An exception describing errno, prefixed with |what|.
+std::runtime_error sys_error(const std::string& what);
+
+// Writes all of |data| to |fd|, however many write(2) calls it takes.
+// Throws std::runtime_error on errors.
+void write_all(int fd, std::string_view data);
+
+// A mapping of [offset, offset + len) of a file, with the start rounded
+// down to a page boundary as mmap requires.
+class Mapping {
+public:
+    Mapping(int fd, uint64_t offset, size_t len, int prot);
+    ~Mapping();
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    char* data() const { return data_; }
+    void advise(int advice) const;
+
+private:
+    void* addr_;
+    size_t len_;
+    char* data_;
+};
+
+// A whole file mapped read-only. Throws std::runtime_error if it cannot be
+// opened or mapped.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+
+    const char* data() const { return map_ ? map_->data() : nullptr; }
+    size_t size() const { return size_; }
+    void advise(int advice) const {
+        if (map_) map_->advise(advice);
+    }
+
+private:
+    std::unique_ptr<Mapping> map_;
+    size_t size_ = 0;
+};
+
+#endif  // MAPPING_H_
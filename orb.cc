@@ -0,0 +1,298 @@
+#include "orb.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <map>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+static constexpr Dir kDirs[] = {Dir::North, Dir::South, Dir::East, Dir::West};
+
+// Weights are kept below this, like every value in the VM.
+static constexpr int kMaxWeight = kMaxInt;
+
+// Levels smaller than this are not worth handing to threads.
+static constexpr size_t kParallelFrontier = 1 << 14;
+
+std::pair<int, int> delta(Dir dir) {
+    switch (dir) {
+        case Dir::North: return {1, 0};
+        case Dir::South: return {-1, 0};
+        case Dir::East: return {0, 1};
+        case Dir::West: return {0, -1};
+    }
+}
+
+// Returns the number quoted after |prefix| in |text|, if there is one.
+std::optional<std::string_view> quoted(std::string_view text,
+                                       std::string_view prefix) {
+    auto l = text.find(prefix);
+    if (l == std::string_view::npos) return std::nullopt;
+    l += prefix.size();
+    auto r = text.find('\'', l);
+    if (r == std::string_view::npos) return std::nullopt;
+    return text.substr(l, r - l);
+}
+
+std::optional<int> quoted_number(std::string_view text,
+                                 std::string_view prefix) {
+    auto s = quoted(text, prefix);
+    if (!s || s->empty() || s->size() > 5) return std::nullopt;
+    int val = 0;
+    for (char ch : *s) {
+        if (ch < '0' || ch > '9') return std::nullopt;
+        val = val * 10 + (ch - '0');
+    }
+    return val;
+}
+
+struct Room {
+    Game game;
+    int row, col;
+};
+
+}  // namespace
+
+const char* to_string(Dir dir) {
+    switch (dir) {
+        case Dir::North: return "north";
+        case Dir::South: return "south";
+        case Dir::East: return "east";
+        case Dir::West: return "west";
+    }
+}
+
+std::optional<OrbGrid> map_orb_grid(const Game& game) {
+    auto probe = game.fork();
+    auto start_weight =
+        quoted_number(probe.input("look"), "the number '");
+    if (!start_weight) return std::nullopt;
+
+    // tiles by position relative to the start
+    std::map<std::pair<int, int>, OrbGrid::Tile> tiles;
+    tiles[{0, 0}] = {true, 0, *start_weight};
+    std::optional<std::pair<int, int>> target;
+    int target_weight = 0;
+
+    std::vector<Room> rooms;
+    rooms.push_back({game.fork(), 0, 0});
+    while (!rooms.empty()) {
+        auto room = std::move(rooms.back());
+        rooms.pop_back();
+        for (auto dir : kDirs) {
+            auto [dr, dc] = delta(dir);
+            std::pair<int, int> pos = {room.row + dr, room.col + dc};
+            if (tiles.count(pos)) continue;
+            auto next = room.game.fork();
+            auto text = next.input(to_string(dir));
+            auto floor = Game::parse_room(text);
+            if (!floor || floor->name.rfind("Vault ", 0) != 0) continue;
+            OrbGrid::Tile tile{true, 0, 0};
+            if (auto op = quoted(text, "depicting a '")) {
+                if (op->size() != 1) return std::nullopt;
+                tile.op = (*op)[0];
+            } else if (auto val = quoted_number(text, "the number '")) {
+                tile.val = *val;
+            } else {
+                continue;
+            }
+            if (auto weight = quoted_number(text, "it has a large '")) {
+                target = pos;
+                target_weight = *weight;
+            }
+            tiles[pos] = tile;
+            // the walk ends at the target
+            if (target != pos) rooms.push_back({std::move(next), pos.first,
+                                                pos.second});
+        }
+    }
+    if (!target) return std::nullopt;
+
+    int min_row = INT_MAX, max_row = INT_MIN;
+    int min_col = INT_MAX, max_col = INT_MIN;
+    for (const auto& [pos, tile] : tiles) {
+        min_row = std::min(min_row, pos.first);
+        max_row = std::max(max_row, pos.first);
+        min_col = std::min(min_col, pos.second);
+        max_col = std::max(max_col, pos.second);
+    }
+    OrbGrid grid;
+    grid.rows = max_row - min_row + 1;
+    grid.cols = max_col - min_col + 1;
+    grid.tiles.resize(grid.rows * grid.cols);
+    auto index = [&](std::pair<int, int> pos) {
+        return (pos.first - min_row) * grid.cols + pos.second - min_col;
+    };
+    for (const auto& [pos, tile] : tiles) grid.tiles[index(pos)] = tile;
+    grid.start = index({0, 0});
+    grid.target = index(*target);
+    grid.target_weight = target_weight;
+    return grid;
+}
+
+namespace {
+
+// A state reached by the search: a number room and the orb's weight there,
+// with the two steps that led to it from its parent.
+struct Node {
+    uint32_t state;  // room * kMaxWeight + weight
+    uint32_t parent;
+    Dir step1, step2;
+};
+
+// Two steps from a number room, over an operator to another number.
+struct Move {
+    char op;
+    int val;
+    int to;
+    Dir step1, step2;
+};
+
+class Search {
+public:
+    explicit Search(const OrbGrid& grid)
+        : grid_(grid),
+          moves_(grid.tiles.size()),
+          visited_((grid.tiles.size() * kMaxWeight + 63) / 64) {
+        for (int room = 0; room < static_cast<int>(grid.tiles.size());
+             room++) {
+            if (is_number(room)) add_moves(room);
+        }
+    }
+
+    // Appends the unvisited states one move away from nodes[i] to |out|,
+    // marking them visited unless |out| is a worker's private list. Returns
+    // true if one of them opens the vault.
+    bool expand(const std::vector<Node>& nodes, uint32_t i,
+                std::vector<Node>& out, bool mark) {
+        uint32_t room = nodes[i].state / kMaxWeight;
+        int64_t weight = nodes[i].state % kMaxWeight;
+        for (const auto& move : moves_[room]) {
+            int64_t w = move.op == '+'   ? weight + move.val
+                        : move.op == '-' ? weight - move.val
+                                         : weight * move.val;
+            if (w <= 0 || w >= kMaxWeight) continue;
+            bool target = move.to == grid_.target;
+            if (target && w != grid_.target_weight) continue;
+            uint32_t state = move.to * kMaxWeight + w;
+            if (visited(state)) continue;
+            if (mark) visit(state);
+            out.push_back({state, i, move.step1, move.step2});
+            if (mark && target) return true;
+        }
+        return false;
+    }
+
+    bool visited(uint32_t state) const {
+        return visited_[state / 64] >> (state % 64) & 1;
+    }
+    void visit(uint32_t state) { visited_[state / 64] |= 1ull << (state % 64); }
+
+private:
+    bool is_number(int room) const {
+        return grid_.tiles[room].room && grid_.tiles[room].op == 0;
+    }
+
+    // Returns the room |dir| of |room|, or -1 at the edge of the grid.
+    int neighbor(int room, Dir dir) const {
+        auto [dr, dc] = delta(dir);
+        int row = room / grid_.cols + dr, col = room % grid_.cols + dc;
+        if (row < 0 || row >= grid_.rows || col < 0 || col >= grid_.cols) {
+            return -1;
+        }
+        return row * grid_.cols + col;
+    }
+
+    void add_moves(int room) {
+        for (auto step1 : kDirs) {
+            int op = neighbor(room, step1);
+            if (op < 0 || !grid_.tiles[op].room) continue;
+            char sym = grid_.tiles[op].op;
+            if (sym != '+' && sym != '-' && sym != '*') continue;
+            for (auto step2 : kDirs) {
+                int to = neighbor(op, step2);
+                // returning to the start resets the orb
+                if (to < 0 || to == grid_.start || !is_number(to)) continue;
+                moves_[room].push_back(
+                    {sym, grid_.tiles[to].val, to, step1, step2});
+            }
+        }
+    }
+
+    const OrbGrid& grid_;
+    std::vector<std::vector<Move>> moves_;  // by room
+    std::vector<uint64_t> visited_;         // a bit per state
+};
+
+}  // namespace
+
+std::optional<OrbPath> solve_orb(const OrbGrid& grid, unsigned threads) {
+    auto t0 = std::chrono::steady_clock::now();
+    const auto& start = grid.tiles[grid.start];
+    if (start.op != 0 || start.val <= 0 || start.val >= kMaxWeight) {
+        return std::nullopt;
+    }
+    Search search(grid);
+    std::vector<Node> nodes;
+    nodes.push_back({static_cast<uint32_t>(grid.start * kMaxWeight +
+                                           start.val),
+                     0, Dir::North, Dir::North});
+    search.visit(nodes[0].state);
+
+    bool found = false;
+    size_t level = 0;
+    while (level < nodes.size() && !found) {
+        size_t end = nodes.size();
+        size_t n = end - level;
+        if (n < kParallelFrontier || threads <= 1) {
+            for (size_t i = level; i < end && !found; i++) {
+                found = search.expand(nodes, i, nodes, true);
+            }
+            level = end;
+            continue;
+        }
+        // each worker expands a contiguous chunk, so merging the chunks in
+        // order finds the same states as expanding serially
+        std::vector<std::vector<Node>> chunks(threads);
+        auto work = [&](unsigned w) {
+            for (size_t i = level + n * w / threads;
+                 i < level + n * (w + 1) / threads; i++) {
+                search.expand(nodes, i, chunks[w], false);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (unsigned w = 1; w < threads; w++) pool.emplace_back(work, w);
+        work(0);
+        for (auto& t : pool) t.join();
+        for (const auto& chunk : chunks) {
+            for (const auto& node : chunk) {
+                if (search.visited(node.state)) continue;
+                search.visit(node.state);
+                nodes.push_back(node);
+                if (node.state / kMaxWeight ==
+                    static_cast<uint32_t>(grid.target)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (found) break;
+        }
+        level = end;
+    }
+    if (!found) return std::nullopt;
+
+    OrbPath path;
+    path.states = nodes.size();
+    for (uint32_t i = nodes.size() - 1; i != 0; i = nodes[i].parent) {
+        path.steps.push_back(nodes[i].step2);
+        path.steps.push_back(nodes[i].step1);
+    }
+    std::reverse(path.steps.begin(), path.steps.end());
+    path.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - t0)
+                       .count();
+    return path;
+}
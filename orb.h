@@ -0,0 +1,56 @@
+#ifndef ORB_H_
+#define ORB_H_
+
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "game.h"
+
+enum class Dir { North, South, East, West };
+
+const char* to_string(Dir dir);
+
+// The vault lock: a grid of rooms, alternating numbers and operators, that
+// the orb is carried through from the start to the target room. Entering a
+// number applies the operator just passed to the orb's weight. Returning
+// to the start resets the orb and entering the target ends the walk, which
+// opens the vault if the weight matches.
+struct OrbGrid {
+    struct Tile {
+        bool room = false;
+        char op = 0;  // '+', '-' or '*', or 0 for a number
+        int val = 0;
+    };
+
+    int rows = 0;
+    int cols = 0;
+    std::vector<Tile> tiles;  // row by row, row 0 along the south side
+    int start = 0;            // tile indices
+    int target = 0;
+    int target_weight = 0;
+
+    const Tile& at(int row, int col) const { return tiles[row * cols + col]; }
+};
+
+// Maps the grid by walking it on forks of |game|, which must be in the
+// start room, and reading each room's description. Returns nothing if the
+// rooms do not describe a grid with a start and a target.
+std::optional<OrbGrid> map_orb_grid(const Game& game);
+
+struct OrbPath {
+    std::vector<Dir> steps;
+    uint64_t states = 0;  // (room, weight) states visited
+    double seconds = 0;
+};
+
+// Finds a shortest path that opens the vault by breadth-first search over
+// (room, weight) states, each visited once. Weights stay within the VM's
+// 15 bits. Levels with large frontiers are expanded across |threads|, and
+// merged in order so the path found does not depend on them.
+std::optional<OrbPath> solve_orb(
+    const OrbGrid& grid,
+    unsigned threads = std::thread::hardware_concurrency());
+
+#endif  // ORB_H_
@@ -0,0 +1,118 @@
+#include "perf.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace {
+
+struct CounterInfo {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static constexpr CounterInfo kCounters[Perf::kN] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+int open_counter(const CounterInfo& info) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = info.type;
+    attr.config = info.config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out += buf;
+        } else {
+            out += ch;
+        }
+    }
+    return out + "\"";
+}
+
+}  // namespace
+
+Perf::Perf() {
+    available_ = true;
+    for (int i = 0; i < kN; i++) {
+        fds_[i] = open_counter(kCounters[i]);
+        available_ &= fds_[i] >= 0;
+    }
+}
+
+Perf::~Perf() {
+    for (int fd : fds_) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void Perf::read(uint64_t counts[kN]) const {
+    for (int i = 0; i < kN; i++) {
+        counts[i] = 0;
+        if (!available_) continue;
+        if (::read(fds_[i], &counts[i], sizeof(counts[i])) < 0) counts[i] = 0;
+    }
+}
+
+Perf::Phase::Phase(Perf* perf, std::string name) : perf_(perf) {
+    if (perf_ == nullptr) return;
+    index_ = perf_->phases_.size();
+    perf_->phases_.push_back({std::move(name), perf_->depth_++});
+    perf_->read(counts_);
+    start_ = std::chrono::steady_clock::now();
+}
+
+Perf::Phase::~Phase() {
+    if (perf_ == nullptr) return;
+    auto end = std::chrono::steady_clock::now();
+    uint64_t counts[kN];
+    perf_->read(counts);
+    auto& rec = perf_->phases_[index_];
+    rec.seconds = std::chrono::duration<double>(end - start_).count();
+    for (int i = 0; i < kN; i++) rec.counts[i] = counts[i] - counts_[i];
+    perf_->depth_--;
+}
+
+void Perf::write_json(std::ostream& os) const {
+    os << "{\n  \"counters\": " << (available_ ? "true" : "false") << ",\n";
+    os << "  \"phases\": [";
+    for (size_t i = 0; i < phases_.size(); i++) {
+        const auto& rec = phases_[i];
+        os << (i == 0 ? "\n" : ",\n") << "    {\"name\": "
+           << json_string(rec.name) << ", \"depth\": " << rec.depth
+           << ", \"seconds\": " << rec.seconds;
+        if (available_) {
+            for (int j = 0; j < kN; j++) {
+                os << ", \"" << kCounters[j].name << "\": " << rec.counts[j];
+            }
+            double cycles = rec.counts[kCycles];
+            double instrs = rec.counts[kInstructions];
+            os << ", \"ipc\": " << (cycles > 0 ? instrs / cycles : 0)
+               << ", \"branch_misses_per_kinstr\": "
+               << (instrs > 0 ? 1000 * rec.counts[kBranchMisses] / instrs : 0);
+        }
+        os << "}";
+    }
+    os << "\n  ]\n}\n";
+}
@@ -0,0 +1,66 @@
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Hardware counters read through perf_event_open, collected per named
+// phase of a run. If the kernel or sandbox refuses the counters, phases
+// still record wall time and the report says the counters are missing.
+// Counters are inherited by threads created after construction, so phases
+// include the work of threads joined before they end.
+class Perf {
+public:
+    enum Counter { kCycles, kInstructions, kBranchMisses, kCacheMisses, kN };
+
+    Perf();
+    ~Perf();
+    Perf(const Perf&) = delete;
+    Perf& operator=(const Perf&) = delete;
+
+    bool available() const { return available_; }
+
+    // Measures its own lifetime as a phase of |perf|. Does nothing if
+    // |perf| is null. Phases started inside another one are nested in the
+    // report.
+    class Phase {
+    public:
+        Phase(Perf* perf, std::string name);
+        ~Phase();
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+
+    private:
+        Perf* perf_;
+        size_t index_;
+        std::chrono::steady_clock::time_point start_;
+        uint64_t counts_[kN];
+    };
+
+    struct Record {
+        std::string name;
+        int depth;
+        double seconds = 0;
+        uint64_t counts[kN] = {};  // zero if the counters are missing
+    };
+
+    // Every phase started so far, in the order they started. A phase's
+    // record is complete once it ends.
+    const std::vector<Record>& phases() const { return phases_; }
+
+    // Writes every finished phase, in the order they started, as JSON.
+    void write_json(std::ostream& os) const;
+
+private:
+    void read(uint64_t counts[kN]) const;
+
+    int fds_[kN];
+    bool available_ = false;
+    int depth_ = 0;
+    std::vector<Record> phases_;
+};
+
+#endif  // PERF_H_
@@ -0,0 +1,144 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace {
+
+static constexpr size_t kTop = 20;
+
+const char* op_name(uint8_t op) {
+    return is_opcode(op) ? to_string(static_cast<Opcode>(op)) : "(hook)";
+}
+
+double percent(uint64_t n, uint64_t total) {
+    return total == 0 ? 0 : 100.0 * n / total;
+}
+
+// Keys of the |n| largest counts, largest first.
+template <typename Map>
+std::vector<typename Map::key_type> top(const Map& counts, size_t n) {
+    std::vector<std::pair<uint64_t, typename Map::key_type>> v;
+    for (const auto& [key, count] : counts) v.emplace_back(count, key);
+    n = std::min(n, v.size());
+    std::partial_sort(v.begin(), v.begin() + n, v.end(),
+                      [](auto& a, auto& b) { return a.first > b.first; });
+    std::vector<typename Map::key_type> keys;
+    for (size_t i = 0; i < n; i++) keys.push_back(v[i].second);
+    return keys;
+}
+
+}  // namespace
+
+Profile::Profile() : pc_counts_(kMaxInt), nodes_{{0, 0, 0}} {}
+
+void Profile::unwind(size_t depth) {
+    while (!frames_.empty() && frames_.back().depth > depth) {
+        frames_.pop_back();
+    }
+    node_ = frames_.empty() ? 0 : frames_.back().node;
+}
+
+void Profile::call(uint16_t site, uint16_t target, size_t depth) {
+    unwind(depth);
+    uint64_t key = uint64_t(node_) << 32 | uint32_t(site) << 16 | target;
+    auto [it, inserted] = children_.emplace(key, nodes_.size());
+    if (inserted) nodes_.push_back({node_, site, target});
+    node_ = it->second;
+    frames_.push_back({node_, depth + 1});
+}
+
+void Profile::ret(size_t depth) {
+    // the Ret pops below the frame of the routine it returns from
+    unwind(depth - 1);
+}
+
+// Instructions run in each node and everything it called. Children are
+// always created after their parents, so one backwards pass suffices.
+std::vector<uint64_t> Profile::inclusive() const {
+    std::vector<uint64_t> incl(nodes_.size());
+    for (size_t i = nodes_.size(); i-- > 0;) {
+        incl[i] += nodes_[i].self;
+        if (i > 0) incl[nodes_[i].parent] += incl[i];
+    }
+    return incl;
+}
+
+void Profile::report(FILE* out, const VM& vm) const {
+    uint64_t total = 0;
+    for (auto n : op_counts_) total += n;
+    fprintf(out, "%lu instructions, %zu call stacks\n", total, nodes_.size());
+
+    fprintf(out, "\nopcodes:\n");
+    std::map<uint8_t, uint64_t> ops;
+    for (size_t op = 0; op < op_counts_.size(); op++) {
+        if (op_counts_[op] > 0) ops[op] = op_counts_[op];
+    }
+    for (auto op : top(ops, ops.size())) {
+        fprintf(out, "%12lu %5.1f%%  %s\n", ops[op],
+                percent(ops[op], total), op_name(op));
+    }
+
+    fprintf(out, "\nhottest instructions:\n");
+    std::map<uint16_t, uint64_t> pcs;
+    for (size_t pc = 0; pc < pc_counts_.size(); pc++) {
+        if (pc_counts_[pc] > 0) pcs[pc] = pc_counts_[pc];
+    }
+    for (auto pc : top(pcs, kTop)) {
+        uint16_t words[4];
+        for (int i = 0; i < 4; i++) words[i] = vm.peek(pc + i);
+        fprintf(out, "%12lu %5.1f%%  ", pcs[pc], percent(pcs[pc], total));
+        print_instr(out, pc, words);
+    }
+
+    // a recursive routine's inclusive count only includes its outermost
+    // activation, and likewise for a call site
+    auto incl = inclusive();
+    std::map<uint16_t, uint64_t> fn_self, fn_incl, site_incl;
+    for (size_t i = 1; i < nodes_.size(); i++) {
+        const auto& node = nodes_[i];
+        fn_self[node.fn] += node.self;
+        bool fn_outer = true, site_outer = true;
+        for (auto p = node.parent; p != 0; p = nodes_[p].parent) {
+            fn_outer &= nodes_[p].fn != node.fn;
+            site_outer &= nodes_[p].site != node.site;
+        }
+        if (fn_outer) fn_incl[node.fn] += incl[i];
+        if (site_outer) site_incl[node.site] += incl[i];
+    }
+
+    fprintf(out, "\nfunctions by inclusive count:\n");
+    fprintf(out, "%12s %6s %12s %6s\n", "inclusive", "", "exclusive", "");
+    for (auto fn : top(fn_incl, kTop)) {
+        fprintf(out, "%12lu %5.1f%% %12lu %5.1f%%  %u\n", fn_incl[fn],
+                percent(fn_incl[fn], total), fn_self[fn],
+                percent(fn_self[fn], total), fn);
+    }
+
+    fprintf(out, "\ncall sites by inclusive count:\n");
+    for (auto site : top(site_incl, kTop)) {
+        uint16_t words[4];
+        for (int i = 0; i < 4; i++) words[i] = vm.peek(site + i);
+        fprintf(out, "%12lu %5.1f%%  ", site_incl[site],
+                percent(site_incl[site], total));
+        print_instr(out, site, words);
+    }
+}
+
+void Profile::write_folded(FILE* out) const {
+    std::vector<uint16_t> path;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        if (nodes_[i].self == 0) continue;
+        path.clear();
+        for (auto n = i; n != 0; n = nodes_[n].parent) {
+            path.push_back(nodes_[n].fn);
+        }
+        fprintf(out, "main");
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            fprintf(out, ";%u", *it);
+        }
+        fprintf(out, " %lu\n", nodes_[i].self);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "vm.h"
+
+// Instruction counts collected by a VM running with Options::profile: per
+// pc, per opcode and per call stack. The call stack is rebuilt from Call
+// and Ret; each distinct stack is a node in a tree keyed by call site and
+// target, and every instruction is charged to the node it ran in. All
+// counters are flat arrays, so counting is a few increments.
+class Profile {
+public:
+    Profile();
+
+    void count(uint16_t pc, uint8_t op) {
+        pc_counts_[pc]++;
+        op_counts_[op]++;
+        nodes_[node_].self++;
+    }
+
+    // |depth| is the size of the VM stack before the return address is
+    // pushed or popped. A routine that leaves without its Ret (a hook, or
+    // code that unwinds the stack by hand) is dropped from the shadow stack
+    // once the VM stack is no deeper than its call.
+    void call(uint16_t site, uint16_t target, size_t depth);
+    void ret(size_t depth);
+
+    // Prints totals, the opcode histogram and the hottest pcs, functions
+    // and call sites. |vm| supplies the code for the pcs.
+    void report(FILE* out, const VM& vm) const;
+
+    // Prints one "frame;frame;... count" line per stack, as flamegraph.pl
+    // and similar tools read.
+    void write_folded(FILE* out) const;
+
+private:
+    struct Node {
+        uint32_t parent;
+        uint16_t site;  // address of the Call
+        uint16_t fn;    // its target
+        uint64_t self = 0;
+    };
+    struct Frame {
+        uint32_t node;
+        size_t depth;  // VM stack size with the return address pushed
+    };
+
+    void unwind(size_t depth);
+    std::vector<uint64_t> inclusive() const;
+
+    std::vector<uint64_t> pc_counts_;
+    std::array<uint64_t, 256> op_counts_{};
+    std::vector<Node> nodes_;  // [0] is the root, outside any call
+    std::unordered_map<uint64_t, uint32_t> children_;
+    std::vector<Frame> frames_;
+    uint32_t node_ = 0;
+};
+
+#endif  // PROFILE_H_
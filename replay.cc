@@ -0,0 +1,120 @@
+#include "replay.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include "mapping.h"
+
+Script read_script(const std::string& path) {
+    std::ifstream is(path);
+    if (!is.good()) throw sys_error(path);
+    Script script{path, {}};
+    std::string line;
+    for (int n = 1; std::getline(is, line); n++) {
+        if (line.empty() || line[0] == '#') continue;
+        auto error = [&](const std::string& what) {
+            return std::runtime_error(path + ":" + std::to_string(n) + ": " +
+                                      what);
+        };
+        if (line[0] == '?') {
+            auto start = line.find_first_not_of(" ", 1);
+            if (start == std::string::npos) throw error("empty expectation");
+            script.steps.push_back(
+                {Script::Step::Kind::Expect, n, line.substr(start)});
+        } else if (line[0] == '!') {
+            Script::Step step{Script::Step::Kind::SetReg, n, ""};
+            unsigned reg, val;
+            char extra;
+            if (sscanf(line.c_str(), "! set_reg %u %u %c", &reg, &val,
+                       &extra) != 2) {
+                throw error("bad directive: " + line);
+            }
+            if (reg >= kNumReg || val >= kMaxInt) {
+                throw error("bad register or value: " + line);
+            }
+            step.reg = reg;
+            step.val = val;
+            script.steps.push_back(step);
+        } else {
+            auto& steps = script.steps;
+            if (steps.empty() ||
+                steps.back().kind != Script::Step::Kind::Commands) {
+                steps.push_back({Script::Step::Kind::Commands, n, ""});
+            }
+            steps.back().text += line + '\n';
+            steps.back().commands++;
+        }
+    }
+    if (is.bad()) throw sys_error(path);
+    return script;
+}
+
+Replay replay(const VM& start, const Script& script) {
+    Replay result;
+    VM vm = start.fork();
+    size_t pos = 0;  // where the next expectation starts looking
+    int line = 0;
+    auto fail = [&](const std::string& what) {
+        result.failures.push_back(script.path + ":" + std::to_string(line) +
+                                  ": " + what);
+    };
+    try {
+        // expectations before the first command see the prelude
+        vm.run(result.output);
+        for (const auto& step : script.steps) {
+            line = step.line;
+            switch (step.kind) {
+                case Script::Step::Kind::Commands:
+                    if (vm.state() == VM::State::Halt) {
+                        fail("game over before this command");
+                        return result;
+                    }
+                    vm.input(step.text);
+                    vm.run(result.output);
+                    result.commands += step.commands;
+                    break;
+                case Script::Step::Kind::Expect: {
+                    auto found = result.output.find(step.text, pos);
+                    if (found == std::string::npos) {
+                        fail("expected \"" + step.text + "\"");
+                    } else {
+                        pos = found + step.text.size();
+                    }
+                    break;
+                }
+                case Script::Step::Kind::SetReg:
+                    vm.set_reg(step.reg, step.val);
+                    break;
+            }
+        }
+    } catch (const std::exception& e) {
+        fail(e.what());
+        return result;
+    }
+    result.game_over = vm.state() == VM::State::Halt;
+    if (vm.pending_input() > 0) {
+        fail(std::to_string(vm.pending_input()) + " bytes of input unread");
+    }
+    return result;
+}
+
+std::vector<Replay> replay_all(const VM& start,
+                               const std::vector<Script>& scripts,
+                               unsigned threads) {
+    std::vector<Replay> results(scripts.size());
+    std::atomic<size_t> next = 0;
+    auto work = [&] {
+        for (size_t i; (i = next++) < scripts.size();) {
+            results[i] = replay(start, scripts[i]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads && t < scripts.size(); t++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& w : workers) w.join();
+    return results;
+}
@@ -0,0 +1,54 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vm.h"
+
+// A command script. Each line is one of:
+//
+//   # a comment (blank lines are ignored too)
+//   take tablet          a command
+//   ? gUSJZzKWYHDZ       text the output must contain, after the text of
+//                        the previous expectation
+//   ! set_reg 7 25734    sets a register before the commands that follow
+struct Script {
+    struct Step {
+        enum class Kind { Commands, Expect, SetReg };
+        Kind kind;
+        int line;
+        std::string text;  // newline-terminated commands, or expected text
+        size_t commands = 0;
+        size_t reg = 0;
+        uint16_t val = 0;
+    };
+
+    std::string path;
+    std::vector<Step> steps;  // consecutive commands are merged
+};
+
+// Throws std::runtime_error on I/O errors or malformed lines.
+Script read_script(const std::string& path);
+
+struct Replay {
+    std::string output;
+    std::vector<std::string> failures;  // "path:line: ..." for each one
+    size_t commands = 0;
+    bool game_over = false;
+};
+
+// Runs |script| on a fork of |start|. The commands between directives go
+// into the input queue at once and run in a single pass of the VM.
+Replay replay(const VM& start, const Script& script);
+
+// Replays each script on its own fork of |start|, across |threads|
+// workers. Results are in the order of |scripts|.
+std::vector<Replay> replay_all(
+    const VM& start, const std::vector<Script>& scripts,
+    unsigned threads = std::thread::hardware_concurrency());
+
+#endif  // REPLAY_H_
@@ -0,0 +1,348 @@
+#include "server.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <csignal>
+#include <cstring>
+#include <utility>
+
+#include "mapping.h"
+
+struct Server::Session {
+    explicit Session(SessionId id, VM vm) : id(id), vm(std::move(vm)) {}
+
+    enum class Status { Waiting, Queued, Running, Done };
+
+    const SessionId id;
+    VM vm;            // only touched by the worker running the session
+    std::string out;  // likewise
+
+    std::mutex mu;  // guards the rest
+    std::string in;  // input not yet handed to the VM
+    Status status = Status::Queued;
+    bool closed = false;
+};
+
+Server::Server(VM start, Output output, Ended ended, unsigned threads,
+               uint64_t slice)
+    : start_(std::move(start)),
+      output_(std::move(output)),
+      ended_(std::move(ended)),
+      slice_(slice) {
+    threads = std::max(threads, 1u);
+    for (unsigned i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        workers_.emplace_back(&Server::work, this, i);
+    }
+}
+
+Server::~Server() {
+    {
+        std::lock_guard lock(mu_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) worker.join();
+}
+
+Server::SessionId Server::open() {
+    std::shared_ptr<Session> session;
+    {
+        std::lock_guard lock(sessions_mu_);
+        session = std::make_shared<Session>(next_id_++, start_.fork());
+        sessions_[session->id] = session;
+    }
+    {
+        std::lock_guard lock(mu_);
+        active_++;
+    }
+    auto id = session->id;
+    schedule(std::move(session), next_queue_++ % queues_.size());
+    return id;
+}
+
+void Server::input(SessionId id, std::string_view text) {
+    std::shared_ptr<Session> session;
+    {
+        std::lock_guard lock(sessions_mu_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end()) return;
+        session = it->second;
+    }
+    {
+        std::lock_guard lock(session->mu);
+        if (session->status == Session::Status::Done) return;
+        session->in.append(text);
+        if (session->status != Session::Status::Waiting) return;
+        session->status = Session::Status::Queued;
+    }
+    {
+        std::lock_guard lock(mu_);
+        active_++;
+    }
+    schedule(std::move(session), next_queue_++ % queues_.size());
+}
+
+void Server::close(SessionId id) {
+    std::shared_ptr<Session> session;
+    {
+        std::lock_guard lock(sessions_mu_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end()) return;
+        session = std::move(it->second);
+        sessions_.erase(it);
+    }
+    {
+        std::lock_guard lock(session->mu);
+        session->closed = true;
+    }
+    // a worker that is running the session finishes its slice first
+    std::unique_lock lock(mu_);
+    idle_cv_.wait(lock, [&] {
+        std::lock_guard session_lock(session->mu);
+        return session->status != Session::Status::Running;
+    });
+}
+
+void Server::wait_idle() {
+    std::unique_lock lock(mu_);
+    idle_cv_.wait(lock, [&] { return active_ == 0; });
+}
+
+Server::Stats Server::stats() const {
+    Stats stats;
+    {
+        std::lock_guard lock(sessions_mu_);
+        stats.sessions = next_id_;
+    }
+    stats.slices = slices_;
+    stats.steals = steals_;
+    return stats;
+}
+
+void Server::schedule(std::shared_ptr<Session> session, unsigned queue) {
+    {
+        std::lock_guard lock(queues_[queue]->mu);
+        queues_[queue]->sessions.push_back(std::move(session));
+    }
+    {
+        // counted under mu_ so that a worker about to sleep sees it
+        std::lock_guard lock(mu_);
+        queued_++;
+    }
+    work_cv_.notify_one();
+}
+
+std::shared_ptr<Server::Session> Server::take(unsigned self) {
+    for (;;) {
+        // own queue first, oldest first, then the others' newest
+        for (size_t i = 0; i < queues_.size(); i++) {
+            auto& queue = *queues_[(self + i) % queues_.size()];
+            std::lock_guard lock(queue.mu);
+            if (queue.sessions.empty()) continue;
+            std::shared_ptr<Session> session;
+            if (i == 0) {
+                session = std::move(queue.sessions.front());
+                queue.sessions.pop_front();
+            } else {
+                session = std::move(queue.sessions.back());
+                queue.sessions.pop_back();
+                steals_++;
+            }
+            queued_--;
+            return session;
+        }
+        std::unique_lock lock(mu_);
+        work_cv_.wait(lock, [&] { return stop_ || queued_ > 0; });
+        if (stop_) return nullptr;
+    }
+}
+
+void Server::work(unsigned self) {
+    while (auto session = take(self)) run(session, self);
+}
+
+void Server::run(const std::shared_ptr<Session>& session, unsigned self) {
+    bool closed;
+    {
+        std::lock_guard lock(session->mu);
+        closed = session->closed;
+        if (closed) {
+            session->status = Session::Status::Done;
+        } else {
+            session->vm.input(session->in);
+            session->in.clear();
+            session->status = Session::Status::Running;
+        }
+    }
+    if (closed) {
+        settle(false);
+        return;
+    }
+    slices_++;
+    auto& vm = session->vm;
+    auto& out = session->out;
+    auto state = vm.run(out, slice_);
+    // hand over complete lines, or everything once the session stops (with
+    // no newline, npos + 1 wraps to 0)
+    size_t end = state == VM::State::Run ? out.rfind('\n') + 1 : out.size();
+    if (end > 0) {
+        output_(session->id, std::string_view(out).substr(0, end));
+        out.erase(0, end);
+    }
+    if (state == VM::State::Halt && ended_) ended_(session->id);
+
+    bool runnable;
+    {
+        std::lock_guard lock(session->mu);
+        if (state == VM::State::Halt || session->closed) {
+            session->status = Session::Status::Done;
+            runnable = false;
+        } else if (state == VM::State::Run || !session->in.empty()) {
+            session->status = Session::Status::Queued;
+            runnable = true;
+        } else {
+            session->status = Session::Status::Waiting;
+            runnable = false;
+        }
+    }
+    // the slice ran out or input came in meanwhile: to the back of our own
+    // queue, where idle workers can steal it
+    if (runnable) schedule(session, self);
+    settle(runnable);
+}
+
+void Server::settle(bool active) {
+    {
+        std::lock_guard lock(mu_);
+        if (!active) active_--;
+    }
+    // also wakes close() waiting for the slice to end
+    idle_cv_.notify_all();
+}
+
+Server::Stats serve_lines(VM start, std::istream& in, FILE* out) {
+    std::mutex mu;  // guards names and out
+    std::unordered_map<Server::SessionId, std::string> names;
+    std::string buf;
+    auto output = [&](Server::SessionId id, std::string_view text) {
+        std::lock_guard lock(mu);
+        const auto& name = names[id];
+        buf.clear();
+        while (!text.empty()) {
+            auto end = text.find('\n');
+            end = end == std::string_view::npos ? text.size() : end + 1;
+            buf.append(name).append(" ").append(text.substr(0, end));
+            text.remove_prefix(end);
+        }
+        if (buf.back() != '\n') buf.push_back('\n');
+        fwrite(buf.data(), 1, buf.size(), out);
+        fflush(out);
+    };
+
+    Server server(std::move(start), output);
+    std::unordered_map<std::string, Server::SessionId> ids;
+    std::string line;
+    while (std::getline(in, line)) {
+        auto space = line.find(' ');
+        auto name = line.substr(0, space);
+        if (name.empty()) continue;
+        auto it = ids.find(name);
+        if (it == ids.end()) {
+            // named before it can print anything
+            std::lock_guard lock(mu);
+            auto id = server.open();
+            names[id] = name;
+            it = ids.emplace(name, id).first;
+        }
+        if (space != std::string::npos) {
+            server.input(it->second, line.substr(space + 1) + '\n');
+        }
+    }
+    server.wait_idle();
+    return server.stats();
+}
+
+void serve_socket(VM start, const std::string& path) {
+    // a client going away must not kill the server mid-write
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) throw sys_error("socket");
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error(path + ": socket path too long");
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    unlink(path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        throw sys_error(path);
+    }
+
+    std::mutex mu;  // guards fds
+    std::unordered_map<Server::SessionId, int> fds;
+    auto fd_of = [&](Server::SessionId id) {
+        std::lock_guard lock(mu);
+        return fds.at(id);
+    };
+    auto output = [&](Server::SessionId id, std::string_view text) {
+        int fd = fd_of(id);
+        while (!text.empty()) {
+            ssize_t n = write(fd, text.data(), text.size());
+            if (n < 0 && errno == EINTR) continue;
+            // the client is gone; its session closes when poll sees it
+            if (n <= 0) return;
+            text.remove_prefix(n);
+        }
+    };
+    auto ended = [&](Server::SessionId id) { shutdown(fd_of(id), SHUT_WR); };
+    Server server(std::move(start), output, ended);
+
+    std::vector<pollfd> polls = {{listener, POLLIN, 0}};
+    std::unordered_map<int, Server::SessionId> sessions;  // by fd
+    char buf[4096];
+    for (;;) {
+        if (poll(polls.data(), polls.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw sys_error("poll");
+        }
+        for (size_t i = 1; i < polls.size(); i++) {
+            if (polls[i].revents == 0) continue;
+            int fd = polls[i].fd;
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                server.input(sessions[fd], std::string_view(buf, n));
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            // closing waits out a running slice, so the fd is not reused
+            // while a worker may still write to it
+            server.close(sessions[fd]);
+            {
+                std::lock_guard lock(mu);
+                fds.erase(sessions[fd]);
+            }
+            sessions.erase(fd);
+            ::close(fd);
+            polls[i--] = polls.back();
+            polls.pop_back();
+        }
+        if (polls[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) continue;
+            // registered before the session can print anything
+            std::lock_guard lock(mu);
+            auto id = server.open();
+            fds[id] = fd;
+            sessions[fd] = id;
+            polls.push_back({fd, POLLIN, 0});
+        }
+    }
+}
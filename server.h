@@ -0,0 +1,117 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <cstdio>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "vm.h"
+
+// Hosts many game sessions, each a fork of one VM, on a fixed pool of
+// worker threads. A session runs in slices of at most |slice| instructions
+// so that long computations share the workers, and a session blocked on
+// input holds no thread until input for it arrives. Each worker has its
+// own queue of runnable sessions and steals from the others when it runs
+// dry.
+class Server {
+public:
+    using SessionId = uint64_t;
+    // Receives output from worker threads, one or more complete lines at a
+    // time, or what is left before the session blocks. Calls for a session
+    // never overlap and arrive in order.
+    using Output = std::function<void(SessionId id, std::string_view text)>;
+    // Called from a worker when a session's game ends.
+    using Ended = std::function<void(SessionId id)>;
+
+    static constexpr uint64_t kSlice = 100000;
+
+    Server(VM start, Output output, Ended ended = nullptr,
+           unsigned threads = std::thread::hardware_concurrency(),
+           uint64_t slice = kSlice);
+    // Stops the workers; sessions still running are abandoned.
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Starts a session, which runs to its first prompt.
+    SessionId open();
+    // Queues |text| as input to session |id|. Ignored for sessions that
+    // ended or were closed.
+    void input(SessionId id, std::string_view text);
+    // Drops session |id|, waiting for a slice it is running to finish so
+    // that no output for it follows.
+    void close(SessionId id);
+    // Blocks until every session is waiting for input or has ended.
+    void wait_idle();
+
+    struct Stats {
+        uint64_t sessions = 0;
+        uint64_t slices = 0;
+        uint64_t steals = 0;
+    };
+    Stats stats() const;
+
+private:
+    struct Session;
+    struct Queue {
+        std::mutex mu;
+        std::deque<std::shared_ptr<Session>> sessions;
+    };
+
+    void work(unsigned self);
+    std::shared_ptr<Session> take(unsigned self);
+    void schedule(std::shared_ptr<Session> session, unsigned queue);
+    void run(const std::shared_ptr<Session>& session, unsigned self);
+    // Ends a slice, counting the session as idle unless |active|.
+    void settle(bool active);
+
+    VM start_;
+    Output output_;
+    Ended ended_;
+    uint64_t slice_;
+
+    mutable std::mutex sessions_mu_;
+    std::unordered_map<SessionId, std::shared_ptr<Session>> sessions_;
+    SessionId next_id_ = 0;
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::atomic<unsigned> next_queue_ = 0;  // for sessions made runnable
+                                            // from outside the workers
+    // guards waking workers and waiting for idle
+    std::mutex mu_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::atomic<size_t> queued_ = 0;  // sessions in any queue
+    size_t active_ = 0;               // sessions queued or running
+    bool stop_ = false;
+
+    std::atomic<uint64_t> slices_ = 0;
+    std::atomic<uint64_t> steals_ = 0;
+    std::vector<std::thread> workers_;
+};
+
+// Multiplexes sessions over text streams: each line of |in| is a session
+// name, then optionally a space and a command for that session, which is
+// opened the first time its name appears. Each line of output goes to
+// |out| as the session's name, a space and the line. Returns once |in| is
+// exhausted and every session has stopped.
+Server::Stats serve_lines(VM start, std::istream& in, FILE* out);
+
+// Listens on a Unix socket at |path|, running a session for each
+// connection; the game's output is written back to it and the connection
+// is shut down for writing when the game ends. Runs until killed, and
+// throws std::runtime_error if the socket cannot be set up.
+void serve_socket(VM start, const std::string& path);
+
+#endif  // SERVER_H_
@@ -0,0 +1,41 @@
+#include "sink.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "mapping.h"
+
+void BufferSink::write(std::string_view line) {
+    size_t n = std::min(line.size(), capacity_ - size_);
+    memcpy(buf_.get() + size_, line.data(), n);
+    size_ += n;
+    truncated_ |= n < line.size();
+}
+
+FdSink::FdSink(int fd, size_t batch) : fd_(fd), batch_(batch) {
+    buf_.reserve(batch_);
+}
+
+FdSink::~FdSink() {
+    // errors here have nowhere to go
+    try {
+        flush();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+void FdSink::write(std::string_view line) {
+    if (buf_.size() + line.size() > batch_) flush();
+    buf_.append(line);
+}
+
+void FdSink::flush() {
+    // a failed write is not retried
+    try {
+        write_all(fd_, buf_);
+    } catch (const std::runtime_error&) {
+        buf_.clear();
+        throw;
+    }
+    buf_.clear();
+}
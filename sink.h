@@ -0,0 +1,76 @@
+#ifndef SINK_H_
+#define SINK_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Where a game's output goes, a line at a time as the VM produces it.
+class Sink {
+public:
+    virtual ~Sink() = default;
+    // |line| ends in a newline, except for text left before a prompt.
+    virtual void write(std::string_view line) = 0;
+    // Called whenever the game stops for input or ends.
+    virtual void flush() {}
+};
+
+class DiscardSink final : public Sink {
+public:
+    void write(std::string_view) override {}
+};
+
+// Keeps output in a buffer allocated once, dropping whatever does not fit
+// until it is cleared.
+class BufferSink final : public Sink {
+public:
+    explicit BufferSink(size_t capacity)
+        : buf_(new char[capacity]), capacity_(capacity) {}
+    void write(std::string_view line) override;
+
+    std::string_view text() const { return {buf_.get(), size_}; }
+    bool truncated() const { return truncated_; }
+    void clear() {
+        size_ = 0;
+        truncated_ = false;
+    }
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t capacity_;
+    size_t size_ = 0;
+    bool truncated_ = false;
+};
+
+// Calls back with each line. The view is only valid during the call.
+class LineSink final : public Sink {
+public:
+    using Callback = std::function<void(std::string_view line)>;
+    explicit LineSink(Callback callback) : callback_(std::move(callback)) {}
+    void write(std::string_view line) override { callback_(line); }
+
+private:
+    Callback callback_;
+};
+
+// Writes to a file descriptor, batching lines into one write(2) until the
+// batch fills or the game waits for input. Throws std::runtime_error if a
+// write fails.
+class FdSink final : public Sink {
+public:
+    static constexpr size_t kBatch = 4096;
+
+    explicit FdSink(int fd, size_t batch = kBatch);
+    ~FdSink() override;
+    void write(std::string_view line) override;
+    void flush() override;
+
+private:
+    int fd_;
+    size_t batch_;
+    std::string buf_;
+};
+
+#endif  // SINK_H_
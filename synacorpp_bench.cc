@@ -0,0 +1,339 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ackermann.h"
+#include "game.h"
+#include "hooks.h"
+#include "orb.h"
+#include "perf.h"
+#include "replay.h"
+#include "teleporter.h"
+#include "vm.h"
+
+// Times the interpreter, the loaders, the teleporter and orb solvers and
+// whole runs, and prints the results as JSON. Given a baseline written by
+// an earlier run, also prints how each benchmark moved against it.
+//
+//     synacorpp_bench <bin> [<baseline.json>] > bench.json
+
+namespace {
+
+// Each benchmark repeats until it has run this long, after one untimed
+// warm-up call.
+static constexpr double kMinSeconds = 0.3;
+
+// VM instructions per call of the dispatch benchmarks.
+static constexpr uint64_t kBudget = 1 << 20;
+
+struct Result {
+    std::string name;
+    std::string unit;  // what an op is
+    uint64_t ops = 0;
+    Perf::Record record;
+
+    double ns_per_op() const { return record.seconds * 1e9 / ops; }
+};
+
+class Bench {
+public:
+    // Runs |f|, which returns how many ops it did, until kMinSeconds pass.
+    void run(const std::string& name, const std::string& unit,
+             const std::function<uint64_t()>& f) {
+        f();
+        uint64_t ops = 0;
+        {
+            Perf::Phase phase(&perf_, name);
+            auto start = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed{};
+            while (elapsed.count() < kMinSeconds) {
+                ops += f();
+                elapsed = std::chrono::steady_clock::now() - start;
+            }
+        }
+        results_.push_back({name, unit, ops, perf_.phases().back()});
+        fprintf(stderr, "%-28s %14.1f ns/%s\n", name.c_str(),
+                results_.back().ns_per_op(), unit.c_str());
+    }
+
+    const std::vector<Result>& results() const { return results_; }
+    bool counters() const { return perf_.available(); }
+
+private:
+    Perf perf_;
+    std::vector<Result> results_;
+};
+
+// One benchmark per line, so that baselines read back without a parser.
+void write_json(const Bench& bench, FILE* out) {
+    fprintf(out, "{\n  \"counters\": %s,\n  \"benchmarks\": [",
+            bench.counters() ? "true" : "false");
+    const char* sep = "\n";
+    for (const auto& result : bench.results()) {
+        const auto& rec = result.record;
+        fprintf(out,
+                "%s    {\"name\": \"%s\", \"unit\": \"%s\", \"ops\": %lu, "
+                "\"seconds\": %.6f, \"ns_per_op\": %.3f, "
+                "\"ops_per_second\": %.0f",
+                sep, result.name.c_str(), result.unit.c_str(), result.ops,
+                rec.seconds, result.ns_per_op(), result.ops / rec.seconds);
+        if (bench.counters()) {
+            double instrs = rec.counts[Perf::kInstructions];
+            double cycles = rec.counts[Perf::kCycles];
+            fprintf(out,
+                    ", \"instructions_per_op\": %.1f, "
+                    "\"instructions_per_second\": %.0f, \"ipc\": %.3f",
+                    instrs / result.ops, instrs / rec.seconds,
+                    cycles > 0 ? instrs / cycles : 0);
+        }
+        fprintf(out, "}");
+        sep = ",\n";
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// ns_per_op by name, from a file written by write_json.
+std::map<std::string, double> read_baseline(const char* path) {
+    std::ifstream is(path);
+    if (!is.good()) {
+        perror(path);
+        exit(1);
+    }
+    std::map<std::string, double> baseline;
+    std::string line;
+    while (getline(is, line)) {
+        static const std::string kName = "\"name\": \"";
+        static const std::string kNs = "\"ns_per_op\": ";
+        auto name = line.find(kName);
+        auto ns = line.find(kNs);
+        if (name == std::string::npos || ns == std::string::npos) continue;
+        name += kName.size();
+        baseline[line.substr(name, line.find('"', name) - name)] =
+            strtod(line.c_str() + ns + kNs.size(), nullptr);
+    }
+    return baseline;
+}
+
+void compare(const Bench& bench, const std::map<std::string, double>& base) {
+    fprintf(stderr, "\n%-28s %14s %14s %8s\n", "vs baseline", "before",
+            "after", "change");
+    for (const auto& result : bench.results()) {
+        auto it = base.find(result.name);
+        if (it == base.end()) continue;
+        fprintf(stderr, "%-28s %14.1f %14.1f %+7.1f%%\n",
+                result.name.c_str(), it->second, result.ns_per_op(),
+                (result.ns_per_op() / it->second - 1) * 100);
+    }
+}
+
+constexpr uint16_t reg(int i) { return kMaxInt + i; }
+
+uint16_t op(Opcode op) { return static_cast<uint16_t>(op); }
+
+// Endless loops that each exercise one class of instructions, starting
+// at address 0.
+std::map<std::string, std::vector<uint16_t>> dispatch_programs() {
+    using O = Opcode;
+    std::map<std::string, std::vector<uint16_t>> programs;
+    programs["arith"] = {
+        op(O::Add), reg(0), reg(0), 1,
+        op(O::Mult), reg(1), reg(0), 3,
+        op(O::Mod), reg(2), reg(1), 7,
+        op(O::Jmp), 0,
+    };
+    programs["logic"] = {
+        op(O::And), reg(1), reg(0), reg(2),
+        op(O::Or), reg(2), reg(1), 123,
+        op(O::Not), reg(3), reg(2),
+        op(O::Eq), reg(4), reg(3), reg(1),
+        op(O::Gt), reg(5), reg(0), reg(4),
+        op(O::Add), reg(0), reg(0), 1,
+        op(O::Jmp), 0,
+    };
+    // reads and writes a 256-word table at 1000, clear of the code
+    programs["memory"] = {
+        op(O::Add), reg(0), reg(0), 1,
+        op(O::And), reg(0), reg(0), 255,
+        op(O::Add), reg(1), reg(0), 1000,
+        op(O::Rmem), reg(2), reg(1),
+        op(O::Wmem), reg(1), reg(0),
+        op(O::Jmp), 0,
+    };
+    programs["stack"] = {
+        op(O::Push), reg(0),
+        op(O::Push), 5,
+        op(O::Pop), reg(1),
+        op(O::Pop), reg(2),
+        op(O::Add), reg(0), reg(0), 1,
+        op(O::Jmp), 0,
+    };
+    programs["call"] = {
+        op(O::Call), 4,
+        op(O::Jmp), 0,
+        op(O::Ret),
+    };
+    // alternates between taken and fallthrough branches
+    programs["branch"] = {
+        op(O::Add), reg(0), reg(0), 1,
+        op(O::And), reg(1), reg(0), 1,
+        op(O::Jt), reg(1), 14,
+        op(O::Jf), reg(1), 0,
+        op(O::Jmp), 0,
+    };
+    programs["out"] = {
+        op(O::Out), 'x',
+        op(O::Jmp), 0,
+    };
+    return programs;
+}
+
+void bench_dispatch(Bench& bench) {
+    for (const auto& [name, program] : dispatch_programs()) {
+        VM vm(program);
+        std::string out;
+        bench.run("dispatch/" + name, "instr", [&] {
+            out.clear();
+            if (vm.run(out, kBudget) != VM::State::Run) {
+                fprintf(stderr, "dispatch/%s stopped early\n", name.c_str());
+                exit(1);
+            }
+            return kBudget;
+        });
+    }
+    VM vm(dispatch_programs()["arith"]);
+    bench.run("step/arith", "instr", [&] {
+        for (uint64_t i = 0; i < kBudget; i++) vm.step();
+        return kBudget;
+    });
+}
+
+void bench_load(Bench& bench, const std::string& path) {
+    bench.run("load/read_program", "load", [&] {
+        return read_program(path).size() > 0;
+    });
+    bench.run("load/load_program", "load", [&] {
+        return VM::load_program(path, {}).pc() == 0;
+    });
+    // the self-test and decryption, decoding as it goes
+    auto loaded = VM::load_program(path, {});
+    install_hooks(loaded);
+    bench.run("load/prelude", "run", [&] {
+        auto vm = loaded.fork();
+        std::string out;
+        vm.run(out);
+        return 1;
+    });
+}
+
+// Successive candidates for r7, which is a 15-bit number.
+uint16_t next_r7(uint16_t& r7) {
+    r7 = (r7 + 1) % kMaxInt;
+    return r7;
+}
+
+void bench_teleporter(Bench& bench) {
+    uint16_t r7 = 0;
+    bench.run("teleporter/verify_reg8", "candidate", [&] {
+        verify_reg8(next_r7(r7));
+        return 1;
+    });
+    auto backend = best_backend();
+    std::vector<uint16_t> candidates(256), out(candidates.size());
+    bench.run(std::string("teleporter/ackermann_4_1/") + to_string(backend),
+              "candidate", [&] {
+        for (auto& candidate : candidates) candidate = next_r7(r7);
+        ackermann_4_1(backend, candidates.data(), out.data(),
+                      candidates.size());
+        return candidates.size();
+    });
+    bench.run("teleporter/search_reg8", "search", [] {
+        return search_reg8().r7.has_value();
+    });
+}
+
+// Plays |script| up to the command that picks up the orb, which leaves the
+// game in the grid's start room.
+Game reach_orb(const std::string& path, const Script& script) {
+    Game game(VM::load_program(path, {}));
+    for (const auto& step : script.steps) {
+        if (step.kind == Script::Step::Kind::SetReg) {
+            game.vm().set_reg(step.reg, step.val);
+        }
+        if (step.kind != Script::Step::Kind::Commands) continue;
+        std::istringstream is(step.text);
+        std::string cmd;
+        while (getline(is, cmd)) {
+            game.input(cmd);
+            if (cmd == "take orb") return game;
+        }
+    }
+    fprintf(stderr, "%s never takes the orb\n", script.path.c_str());
+    exit(1);
+}
+
+void bench_orb(Bench& bench, const std::string& path, const Script& script) {
+    auto game = reach_orb(path, script);
+    auto grid = map_orb_grid(game);
+    if (!grid) {
+        fprintf(stderr, "no orb grid\n");
+        exit(1);
+    }
+    bench.run("orb/map_orb_grid", "map", [&] {
+        return map_orb_grid(game).has_value();
+    });
+    bench.run("orb/solve_orb", "solve", [&] {
+        return solve_orb(*grid).has_value();
+    });
+}
+
+void bench_run(Bench& bench, const std::string& path, const Script& script) {
+    auto start = VM::load_program(path, {});
+    install_hooks(start);
+    bench.run("run/replay", "playthrough", [&] {
+        return replay(start, script).failures.empty();
+    });
+    auto cmd = "./synacorpp run " + path + " > /dev/null";
+    bench.run("run/synacorpp", "run", [&] {
+        if (system(cmd.c_str()) != 0) {
+            fprintf(stderr, "%s failed\n", cmd.c_str());
+            exit(1);
+        }
+        return 1;
+    });
+}
+
+}  // namespace
+
+static constexpr char kScriptPath[] = "challenge.script";
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: synacorpp_bench <bin> [<baseline.json>]\n");
+        return 1;
+    }
+    std::string path = argv[1];
+    std::map<std::string, double> baseline;
+    if (argc > 2) baseline = read_baseline(argv[2]);
+    try {
+        auto script = read_script(kScriptPath);
+        Bench bench;
+        bench_dispatch(bench);
+        bench_load(bench, path);
+        bench_teleporter(bench);
+        bench_orb(bench, path, script);
+        bench_run(bench, path, script);
+        write_json(bench, stdout);
+        if (!baseline.empty()) compare(bench, baseline);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "teleporter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <vector>
+
+#include "ackermann.h"
+#include "vm.h"
+
+namespace {
+
+static constexpr uint16_t kTarget = 6;
+static constexpr int kLevels = 5;
+// a multiple of the widest backend's batch
+static constexpr uint32_t kChunk = 128;
+
+// Results of the routine for one r7, indexed by (r0, r1). Each slot holds
+// the generation it was written in next to the value, so moving on to the
+// next candidate is a counter bump instead of clearing 640KB.
+class Memo {
+public:
+    Memo() : slots_(kLevels * kMaxInt, 0) {}
+
+    void reset() {
+        if (++gen_ == 0) {
+            std::fill(slots_.begin(), slots_.end(), 0);
+            gen_ = 1;
+        }
+    }
+
+    std::optional<uint16_t> get(uint16_t r0, uint16_t r1) const {
+        auto slot = slots_[r0 * kMaxInt + r1];
+        if (slot >> 16 != gen_) return std::nullopt;
+        return slot & 0xffff;
+    }
+
+    void put(uint16_t r0, uint16_t r1, uint16_t val) {
+        slots_[r0 * kMaxInt + r1] = (static_cast<uint32_t>(gen_) << 16) | val;
+    }
+
+private:
+    uint16_t gen_ = 0;
+    std::vector<uint32_t> slots_;
+};
+
+uint16_t verify(uint16_t r0, uint16_t r1, uint16_t r7, Memo& memo) {
+    /*
+    [    6027] JT r0 6035
+    [    6030] ADD r0 r1 1
+    [    6034] RET
+    [    6035] JT r1 6048
+    [    6038] ADD r0 r0 32767
+    [    6042] SET r1 r7
+    [    6045] CALL 6027
+    [    6047] RET
+    [    6048] PUSH r0
+    [    6050] ADD r1 r1 32767
+    [    6054] CALL 6027
+    [    6056] SET r1 r0
+    [    6059] POP r0
+    [    6061] ADD r0 r0 32767
+    [    6065] CALL 6027
+    [    6067] RET
+    */
+
+    assert(r0 < kLevels);
+    assert(r1 < kMaxInt);
+    if (r0 == 0) return (r1 + 1) % kMaxInt;
+    if (auto val = memo.get(r0, r1); val.has_value()) return *val;
+    if (r1 > 0) {
+        uint16_t y = verify(r0, (r1 + 32767) % kMaxInt, r7, memo);
+        uint16_t x = verify((r0 + 32767) % kMaxInt, y, r7, memo);
+        memo.put(r0, r1, x);
+        return x;
+    } else {
+        uint16_t x = verify((r0 + 32767) % kMaxInt, r7, r7, memo);
+        memo.put(r0, r1, x);
+        return x;
+    }
+}
+
+// A half-open range of candidates packed as (end << 32 | begin) so that the
+// owner taking from the front and thieves taking from the back can both
+// update it with a single compare-and-swap.
+class Range {
+public:
+    void assign(uint32_t begin, uint32_t end) { span_.store(pack(begin, end)); }
+
+    bool take_front(uint32_t n, uint32_t& begin, uint32_t& end) {
+        auto span = span_.load();
+        while (true) {
+            auto [b, e] = unpack(span);
+            if (b >= e) return false;
+            auto mid = std::min(b + n, e);
+            if (span_.compare_exchange_weak(span, pack(mid, e))) {
+                begin = b;
+                end = mid;
+                return true;
+            }
+        }
+    }
+
+    bool steal_back(uint32_t& begin, uint32_t& end) {
+        auto span = span_.load();
+        while (true) {
+            auto [b, e] = unpack(span);
+            if (b >= e) return false;
+            auto mid = b + (e - b) / 2;
+            if (span_.compare_exchange_weak(span, pack(b, mid))) {
+                begin = mid;
+                end = e;
+                return true;
+            }
+        }
+    }
+
+private:
+    static uint64_t pack(uint32_t begin, uint32_t end) {
+        return (static_cast<uint64_t>(end) << 32) | begin;
+    }
+    static std::pair<uint32_t, uint32_t> unpack(uint64_t span) {
+        return {span & 0xffffffff, span >> 32};
+    }
+
+    std::atomic<uint64_t> span_{0};
+};
+
+}  // namespace
+
+uint16_t verify_reg8(uint16_t r7) {
+    // one table per thread for every call, so that a new candidate only
+    // bumps the generation
+    static thread_local Memo memo;
+    memo.reset();
+    return verify(4, 1, r7, memo);
+}
+
+Reg8Search search_reg8(unsigned threads, AckermannBackend backend) {
+    threads = std::max(1u, threads);
+    auto start = std::chrono::steady_clock::now();
+
+    // alignas keeps each worker's range on its own cache line
+    struct alignas(64) Worker {
+        Range range;
+        uint64_t checked = 0;
+    };
+    std::vector<Worker> workers(threads);
+    for (unsigned i = 0; i < threads; i++) {
+        workers[i].range.assign(kMaxInt * i / threads,
+                                kMaxInt * (i + 1) / threads);
+    }
+    std::atomic<uint32_t> best{kMaxInt};
+
+    auto work = [&](unsigned self) {
+        auto& me = workers[self];
+        uint32_t begin, end;
+        uint16_t r7[kChunk], result[kChunk];
+        while (true) {
+            if (!me.range.take_front(kChunk, begin, end)) {
+                bool stole = false;
+                for (unsigned i = 1; i < threads && !stole; i++) {
+                    auto& victim = workers[(self + i) % threads];
+                    stole = victim.range.steal_back(begin, end);
+                }
+                if (!stole) return;
+                me.range.assign(begin, end);
+                continue;
+            }
+            auto limit = best.load(std::memory_order_relaxed);
+            uint32_t n = 0;
+            for (auto i = begin; i < end && i < limit; i++) r7[n++] = i;
+            if (n < end - begin) {
+                // the rest of this range can only hold larger matches
+                me.range.assign(0, 0);
+            }
+            ackermann_4_1(backend, r7, result, n);
+            me.checked += n;
+            for (uint32_t i = 0; i < n; i++) {
+                if (result[i] != kTarget) continue;
+                while (r7[i] < limit &&
+                       !best.compare_exchange_weak(limit, r7[i])) {}
+                break;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(work, i);
+    work(0);
+    for (auto& t : pool) t.join();
+
+    Reg8Search result;
+    if (auto r7 = best.load(); r7 < kMaxInt) result.r7 = r7;
+    for (const auto& w : workers) result.checked += w.checked;
+    result.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    return result;
+}
@@ -0,0 +1,35 @@
+#ifndef TELEPORTER_H_
+#define TELEPORTER_H_
+
+#include <cstdint>
+#include <optional>
+#include <thread>
+
+#include "ackermann.h"
+
+// The teleporter's confirmation routine at address 6027 computes a variant
+// of the Ackermann function with r7 as an extra parameter. Searching for
+// the r7 that makes it return 6 replaces running the routine in the VM.
+//
+// verify_reg8 follows the bytecode's recursion call for call (with
+// memoization) and is kept as the reference for the Ackermann evaluator
+// that the search uses.
+uint16_t verify_reg8(uint16_t r7);
+
+struct Reg8Search {
+    std::optional<uint16_t> r7;  // smallest matching value, if any
+    uint64_t checked = 0;        // candidates evaluated
+    double seconds = 0;
+
+    double rate() const { return seconds > 0 ? checked / seconds : 0; }
+};
+
+// Evaluates the candidate values of r7 on |threads| worker threads, which
+// steal ranges from each other when they run out, and stops as soon as
+// every value below the first match has been ruled out. Each worker checks
+// its candidates in batches with |backend|.
+Reg8Search search_reg8(
+    unsigned threads = std::thread::hardware_concurrency(),
+    AckermannBackend backend = best_backend());
+
+#endif  // TELEPORTER_H_
@@ -0,0 +1,78 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "mapping.h"
+#include "vm.h"
+
+namespace {
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+static constexpr char kMagic[8] = {'S', 'Y', 'N', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t kVersion = 1;
+
+}  // namespace
+
+TraceWriter::TraceWriter(const std::string& path)
+    : fd_(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)),
+      size_(sizeof(Header)),
+      ring_(kRingSize) {
+    if (fd_ < 0) throw sys_error(path);
+    Header header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.record_size = sizeof(TraceRecord);
+    if (write(fd_, &header, sizeof(header)) != sizeof(header)) {
+        close(fd_);
+        throw sys_error(path);
+    }
+}
+
+TraceWriter::~TraceWriter() {
+    try {
+        flush();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "trace: %s\n", e.what());
+    }
+    close(fd_);
+}
+
+void TraceWriter::flush() {
+    // the ring only fills up to its end before it is flushed, so pending
+    // records are always contiguous
+    size_t n = head_ - tail_;
+    if (n == 0) return;
+    size_t len = n * sizeof(TraceRecord);
+    if (ftruncate(fd_, size_ + len) != 0) throw sys_error("ftruncate");
+    Mapping dst(fd_, size_, len, PROT_WRITE);
+    memcpy(dst.data(), &ring_[tail_ & kRingMask], len);
+    size_ += len;
+    tail_ = head_;
+}
+
+void dump_trace(const std::string& path, FILE* out) {
+    MappedFile file(path);
+    Header header{};
+    if (file.size() >= sizeof(header)) {
+        memcpy(&header, file.data(), sizeof(header));
+    }
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion ||
+        header.record_size != sizeof(TraceRecord)) {
+        throw std::runtime_error(path + ": not a trace");
+    }
+    file.advise(MADV_SEQUENTIAL);
+    auto* recs =
+        reinterpret_cast<const TraceRecord*>(file.data() + sizeof(header));
+    size_t n = (file.size() - sizeof(header)) / sizeof(TraceRecord);
+    for (size_t i = 0; i < n; i++) print_instr(out, recs[i].pc, recs[i].words);
+}
@@ -0,0 +1,56 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// One executed instruction in a binary trace: its address and the four
+// words starting there (only the first 1 + arity are meaningful).
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t words[4];
+};
+static_assert(sizeof(TraceRecord) == 10);
+
+// Writes a binary trace: a small header, then one TraceRecord per
+// instruction in execution order. Records collect in an in-memory ring and
+// are copied to the file through a mapping whenever the ring fills up, so
+// recording an instruction is a few stores. The VM runs on one thread,
+// which is the only writer, so the ring needs no locking.
+class TraceWriter {
+public:
+    // Truncates |path|. Throws std::runtime_error if it cannot be opened.
+    explicit TraceWriter(const std::string& path);
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    void record(uint16_t pc, const uint16_t words[4]) {
+        auto& rec = ring_[head_++ & kRingMask];
+        rec.pc = pc;
+        memcpy(rec.words, words, sizeof(rec.words));
+        if ((head_ & kRingMask) == 0) flush();
+    }
+
+    // Copies buffered records to the file.
+    void flush();
+
+private:
+    static constexpr size_t kRingSize = 1 << 16;
+    static constexpr size_t kRingMask = kRingSize - 1;
+
+    int fd_;
+    uint64_t size_;     // bytes in the file
+    uint64_t head_ = 0;  // records written
+    uint64_t tail_ = 0;  // records flushed
+    std::vector<TraceRecord> ring_;
+};
+
+// Prints every record in the trace at |path| as disasm would print the
+// instruction. Throws std::runtime_error if the file is not a valid trace.
+void dump_trace(const std::string& path, FILE* out);
+
+#endif  // TRACE_H_
@@ -0,0 +1,348 @@
+#include "translate.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cfg.h"
+
+namespace {
+
+static constexpr char kHeader[] = R"(// Generated by `synacorpp compile`.
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "hooks.h"
+#include "vm.h"
+
+namespace {
+)";
+
+static constexpr char kRuntime[] = R"(
+// How a translated function stopped: by returning to its caller, by
+// transferring control somewhere its caller must resume from (pc), or by
+// ending native execution.
+enum Exit { kReturn, kJump, kHalt, kFallback };
+
+// A return address that no Ret can match, for functions entered from the
+// top level.
+static constexpr uint16_t kNoReturn = 0xffff;
+
+// Native calls nest with the bytecode's calls; deeper chains unwind to the
+// top level instead of exhausting the native stack.
+static constexpr int kMaxDepth = 10000;
+
+using Fn = Exit (*)(uint16_t ret, uint16_t entry);
+
+uint16_t r0, r1, r2, r3, r4, r5, r6, r7, pc;
+std::vector<uint16_t> stack;
+int depth = 0;
+
+// Counts a native call towards kMaxDepth for as long as it lives.
+struct Depth {
+    Depth() { ++depth; }
+    ~Depth() { --depth; }
+};
+
+bool is_code(uint16_t addr) { return kCode[addr >> 3] >> (addr & 7) & 1; }
+
+Exit call(uint16_t target, uint16_t ret);
+
+// Reads a line at a time, flushing output only when the program actually
+// waits for input.
+int get_char() {
+    static std::string line;
+    static size_t pos = 0;
+    if (pos == line.size()) {
+        fflush(stdout);
+        line.clear();
+        pos = 0;
+        int ch;
+        while ((ch = getchar_unlocked()) != EOF) {
+            line += ch;
+            if (ch == '\n') break;
+        }
+        if (line.empty()) return EOF;
+    }
+    return static_cast<unsigned char>(line[pos++]);
+}
+
+// Runs the rest of the program in the interpreter, failing where it throws
+// (an invalid instruction, or Pop on an empty stack).
+int interpret() {
+    VM vm(std::vector<uint16_t>(mem, mem + kMaxInt));
+    install_hooks(vm);
+    uint16_t regs[] = {r0, r1, r2, r3, r4, r5, r6, r7};
+    for (size_t i = 0; i < kNumReg; i++) vm.set_reg(i, regs[i]);
+    for (auto val : stack) vm.push(val);
+    vm.set_pc(pc);
+    std::string out;
+    try {
+        while (true) {
+            out.clear();
+            auto state = vm.run(out);
+            fwrite(out.data(), 1, out.size(), stdout);
+            if (state != VM::State::In) return 0;
+            int ch;
+            while ((ch = get_char()) != EOF && ch != '\n') vm.input(ch);
+            if (ch == EOF) return 0;
+            vm.input('\n');
+        }
+    } catch (const std::exception& e) {
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+        fprintf(stderr, "%s at %u\n", e.what(), vm.pc());
+        return 1;
+    }
+}
+)";
+
+static constexpr char kMain[] = R"(
+int main() {
+    init();
+    fwrite(kOutput, 1, sizeof(kOutput) - 1, stdout);
+    while (true) {
+        switch (resume(pc)) {
+            case kReturn:
+            case kJump: continue;
+            case kHalt: fflush(stdout); return 0;
+            case kFallback: return interpret();
+        }
+    }
+}
+)";
+
+std::string operand(uint16_t val) {
+    if (val < kMaxInt) return std::to_string(val);
+    return "r" + std::to_string(val - kMaxInt);
+}
+
+// Emits one function per entry point in the CFG. Control flow within the
+// function's blocks becomes gotos, a Call becomes a native call, and a Ret
+// returns natively when it pops the address its caller pushed.
+class Translator {
+public:
+    Translator(const VM& vm, const Cfg& cfg, std::ostream& os)
+        : vm_(vm), cfg_(cfg), os_(os) {}
+
+    void function(uint16_t root, const std::set<uint16_t>& blocks) {
+        blocks_ = &blocks;
+        os_ << "\nExit f" << root << "(uint16_t ret, uint16_t entry) {\n";
+        // the root is not necessarily the lowest leader, so it never falls
+        // through to the first label
+        os_ << "    if (entry != " << root << ") {\n";
+        os_ << "        switch (entry) {\n";
+        for (auto addr : blocks) {
+            os_ << "            case " << addr << ": goto L" << addr << ";\n";
+        }
+        os_ << "        }\n    }\n";
+        os_ << "    goto L" << root << ";\n";
+        for (auto leader : blocks) {
+            os_ << "L" << leader << ":\n";
+            auto addrs = cfg_.block(leader);
+            bool hooked = false;
+            for (auto addr : addrs) {
+                // native hooks only exist in the interpreter
+                if ((hooked = vm_.hooked(addr))) {
+                    os_ << "    pc = " << addr << ";\n    return kFallback;\n";
+                    break;
+                }
+                instr(addr, cfg_.instrs.at(addr));
+            }
+            const auto& last = cfg_.instrs.at(addrs.back());
+            if (!hooked && last.op != Opcode::Halt && last.op != Opcode::Jmp &&
+                last.op != Opcode::Ret) {
+                os_ << "    ";
+                jump(addrs.back() + last.size());
+                os_ << "\n";
+            }
+        }
+        os_ << "}\n";
+    }
+
+private:
+    // Transfers control to a literal address.
+    void jump(uint16_t target) {
+        if (blocks_->count(target)) {
+            os_ << "goto L" << target << ";";
+        } else if (cfg_.is_leader(target)) {
+            os_ << "{ pc = " << target << "; return kJump; }";
+        } else {
+            os_ << "{ pc = " << target << "; return kFallback; }";
+        }
+    }
+
+    void instr(uint16_t pc, const Instr& instr) {
+        auto a = operand(instr.args[0]);
+        auto b = operand(instr.args[1]);
+        auto c = operand(instr.args[2]);
+        uint16_t next = pc + instr.size();
+        os_ << "    ";
+        switch (instr.op) {
+            case Opcode::Halt: os_ << "return kHalt;"; break;
+            case Opcode::Set: os_ << a << " = " << b << ";"; break;
+            case Opcode::Push: os_ << "stack.push_back(" << a << ");"; break;
+            case Opcode::Pop:
+                // the interpreter throws, as the VM does
+                os_ << "if (stack.empty()) { pc = " << pc
+                    << "; return kFallback; }\n    " << a
+                    << " = stack.back(); stack.pop_back();";
+                break;
+            case Opcode::Eq:
+                os_ << a << " = " << b << " == " << c << ";";
+                break;
+            case Opcode::Gt: os_ << a << " = " << b << " > " << c << ";"; break;
+            case Opcode::Jmp: {
+                if (instr.args[0] < kMaxInt) {
+                    jump(instr.args[0]);
+                } else {
+                    os_ << "pc = " << a << " & 32767; return kJump;";
+                }
+                break;
+            }
+            case Opcode::Jt:
+            case Opcode::Jf: {
+                os_ << "if (" << a << (instr.op == Opcode::Jt ? " != " : " == ")
+                    << "0) ";
+                if (instr.args[1] < kMaxInt) {
+                    jump(instr.args[1]);
+                } else {
+                    os_ << "{ pc = " << b << " & 32767; return kJump; }";
+                }
+                break;
+            }
+            case Opcode::Add:
+                os_ << a << " = (" << b << " + " << c << ") & 32767;";
+                break;
+            case Opcode::Mult:
+                os_ << a << " = (uint32_t(" << b << ") * " << c
+                    << ") & 32767;";
+                break;
+            case Opcode::Mod:
+                os_ << a << " = (" << b << " % " << c << ") & 32767;";
+                break;
+            case Opcode::And:
+                os_ << a << " = " << b << " & " << c << ";";
+                break;
+            case Opcode::Or: os_ << a << " = " << b << " | " << c << ";"; break;
+            case Opcode::Not: os_ << a << " = ~" << b << " & 32767;"; break;
+            case Opcode::Rmem:
+                os_ << a << " = mem[" << b << " & 32767];";
+                break;
+            case Opcode::Wmem:
+                os_ << "{ uint16_t addr = " << a << " & 32767; mem[addr] = "
+                    << b << "; if (is_code(addr)) { pc = " << next
+                    << "; return kFallback; } }";
+                break;
+            case Opcode::Call: {
+                os_ << "stack.push_back(" << next << "); ";
+                auto target = instr.args[0];
+                if (target < kMaxInt && cfg_.functions.count(target)) {
+                    os_ << "if (depth >= kMaxDepth) { pc = " << target
+                        << "; return kJump; }\n    { Depth d; if (Exit e = f"
+                        << target << "(" << next << ", " << target
+                        << "); e != kReturn) return e; }";
+                } else if (target < kMaxInt) {
+                    os_ << "pc = " << target << "; return kFallback;";
+                } else {
+                    os_ << "if (Exit e = call(" << a << " & 32767, " << next
+                        << "); e != kReturn) return e;";
+                }
+                break;
+            }
+            case Opcode::Ret:
+                os_ << "if (stack.empty()) return kHalt;\n";
+                os_ << "    pc = stack.back() & 32767; stack.pop_back(); "
+                    << "return pc == ret ? kReturn : kJump;";
+                break;
+            case Opcode::Out: os_ << "putchar_unlocked(" << a << ");"; break;
+            case Opcode::In:
+                os_ << "{ int ch = get_char(); "
+                    << "if (ch == EOF) return kHalt; " << a
+                    << " = uint8_t(ch); }";
+                break;
+            case Opcode::Noop: break;
+        }
+        os_ << "  // " << pc << "\n";
+    }
+
+    const VM& vm_;
+    const Cfg& cfg_;
+    std::ostream& os_;
+    const std::set<uint16_t>* blocks_ = nullptr;
+};
+
+}  // namespace
+
+void translate(const VM& vm, std::string_view output, std::ostream& os) {
+    std::vector<uint16_t> mem(kMaxInt);
+    for (size_t i = 0; i < mem.size(); i++) mem[i] = vm.peek(i);
+
+    auto cfg = recover_cfg(mem, live_entries(vm));
+
+    os << kHeader;
+    os << "\nuint16_t mem[] = {";
+    for (size_t i = 0; i < mem.size(); i++) {
+        os << (i % 16 == 0 ? "\n   " : "") << " " << mem[i] << ",";
+    }
+    os << "\n};\n\n// words covered by translated instructions\n";
+    os << "const uint8_t kCode[] = {";
+    for (size_t i = 0; i < mem.size(); i += 8) {
+        int bits = 0;
+        for (int j = 0; j < 8; j++) bits |= cfg.is_code(i + j) << j;
+        os << (i % 128 == 0 ? "\n   " : "") << " " << bits << ",";
+    }
+    os << "\n};\n\nconst char kOutput[] = {";
+    for (size_t i = 0; i < output.size(); i++) {
+        os << (i % 16 == 0 ? "\n   " : "") << " " << int(output[i]) << ",";
+    }
+    os << " 0};\n";
+    os << kRuntime;
+
+    os << "\n";
+    for (const auto& [root, blocks] : cfg.functions) {
+        os << "Exit f" << root << "(uint16_t ret, uint16_t entry);\n";
+    }
+    Translator tr(vm, cfg, os);
+    for (const auto& [root, blocks] : cfg.functions) {
+        if (!blocks.count(root)) {
+            throw std::logic_error("function " + std::to_string(root) +
+                                   " does not contain its root");
+        }
+        tr.function(root, blocks);
+    }
+
+    // computed calls and resumes from the top level enter through these
+    os << "\nExit call(uint16_t target, uint16_t ret) {\n";
+    os << "    switch (target) {\n";
+    for (const auto& [root, blocks] : cfg.functions) {
+        os << "        case " << root << ": return f" << root << "(ret, "
+           << root << ");\n";
+    }
+    os << "    }\n    pc = target;\n    return kJump;\n}\n";
+
+    std::map<uint16_t, uint16_t> owner;
+    for (const auto& [root, blocks] : cfg.functions) {
+        for (auto leader : blocks) owner.emplace(leader, root);
+    }
+    os << "\nExit resume(uint16_t pc) {\n";
+    os << "    switch (pc) {\n";
+    for (auto [leader, root] : owner) {
+        os << "        case " << leader << ": return f" << root
+           << "(kNoReturn, " << leader << ");\n";
+    }
+    os << "    }\n    return kFallback;\n}\n\n";
+    os << "void init() {\n";
+    os << "    stack = {";
+    for (auto val : vm.stack()) os << val << ", ";
+    os << "};\n";
+    for (size_t i = 0; i < kNumReg; i++) {
+        os << "    r" << i << " = " << vm.reg(i) << ";\n";
+    }
+    os << "    pc = " << vm.pc() << ";\n}\n\n}  // namespace\n";
+    os << kMain;
+}
@@ -0,0 +1,23 @@
+#ifndef TRANSLATE_H_
+#define TRANSLATE_H_
+
+#include <ostream>
+#include <string_view>
+
+#include "vm.h"
+
+// Writes a C++ program that continues |vm| from its current state as
+// native code, after printing |output| (whatever the VM printed to get
+// there). Each recovered function becomes a native function: jumps with
+// literal targets within it become gotos, calls become native calls and a
+// Ret that pops its caller's address returns natively. Anything else
+// unwinds to a top-level loop that resumes at the new pc. Writing to a
+// word of translated code, or reaching an address that was not translated
+// or that has a native hook in |vm|, hands the state to the VM interpreter
+// (with install_hooks) for the rest of the run.
+//
+// The program reads input from stdin, writes output to stdout and must be
+// linked with vm.o, trace.o, profile.o, mapping.o, hooks.o and ackermann.o.
+void translate(const VM& vm, std::string_view output, std::ostream& os);
+
+#endif  // TRANSLATE_H_
@@ -1,11 +1,16 @@
 #include "vm.h"
 
-#include <cstdlib>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
 #include <stdexcept>
 #include <string>
 #include <utility>
 
-static bool trace() { return getenv("TRACE") != nullptr; }
+#include "mapping.h"
+#include "profile.h"
+#include "trace.h"
 
 static constexpr Opcode to_opcode(uint16_t op) {
     switch (static_cast<Opcode>(op)) {
@@ -40,33 +45,6 @@ bool is_opcode(uint16_t val) {
            val <= static_cast<uint16_t>(Opcode::Noop);
 }
 
-static constexpr int arity(Opcode op) {
-    switch (op) {
-        case Opcode::Halt: return 0;
-        case Opcode::Set: return 2;
-        case Opcode::Push: return 1;
-        case Opcode::Pop: return 1;
-        case Opcode::Eq: return 3;
-        case Opcode::Gt: return 3;
-        case Opcode::Jmp: return 1;
-        case Opcode::Jt: return 2;
-        case Opcode::Jf: return 2;
-        case Opcode::Add: return 3;
-        case Opcode::Mult: return 3;
-        case Opcode::Mod: return 3;
-        case Opcode::And: return 3;
-        case Opcode::Or: return 3;
-        case Opcode::Not: return 2;
-        case Opcode::Rmem: return 2;
-        case Opcode::Wmem: return 2;
-        case Opcode::Call: return 1;
-        case Opcode::Ret: return 0;
-        case Opcode::Out: return 1;
-        case Opcode::In: return 1;
-        case Opcode::Noop: return 0;
-    }
-}
-
 const char* to_string(Opcode op) {
     switch (op) {
         case Opcode::Halt: return "HALT";
@@ -101,209 +79,427 @@ std::string value_string(uint16_t val) {
     throw std::invalid_argument("invalid number: " + std::to_string(val));
 }
 
-VM::VM(std::vector<uint16_t> program) {
-    for (size_t i = 0; i < program.size(); i++) memset(i, program[i]);
-    for (size_t i = 0; i < reg_.size(); i++) reg_[i] = 0;
+// Maps a value used as an address or jump target into the 15-bit address
+// space. Checked loops report out-of-range values instead of wrapping.
+template <bool kChecked>
+static uint16_t to_addr(uint32_t val) {
+    if (kChecked && val >= kMaxInt) {
+        throw std::out_of_range("invalid address: " + std::to_string(val));
+    }
+    return val & (kMaxInt - 1);
 }
 
-uint16_t VM::get(uint16_t val) const {
-    if (val < kMaxInt) return val;
-    if (auto reg = val - kMaxInt; reg < kNumReg) return reg_[reg];
-    throw std::invalid_argument("invalid number: " + std::to_string(val));
+VM::VM(std::vector<uint16_t> program, Options options) {
+    if (program.size() > kMaxInt) {
+        throw std::invalid_argument("program too large: " +
+                                    std::to_string(program.size()));
+    }
+    for (size_t i = 0; i < program.size(); i += kPageSize) {
+        auto n = std::min<size_t>(kPageSize, program.size() - i);
+        std::copy_n(&program[i], n, mem_[i >> kPageBits].mut().begin());
+    }
+    // every VM starts out sharing one undecoded page
+    static const Cow<CodePage> kUndecodedPage = [] {
+        CodePage page;
+        page.fill(Decoded{kUndecoded, {}});
+        return Cow<CodePage>(page);
+    }();
+    code_.fill(kUndecodedPage);
+    set_options(options);
+    rehash();
 }
 
-void VM::set(uint16_t loc, uint16_t val) {
-    if (loc < kMaxInt || loc >= kMaxInt + 8) {
-        throw std::invalid_argument("invalid register: " + std::to_string(loc));
-    }
-    auto reg = loc - kMaxInt;
-    reg_[reg] = val;
+void VM::set_options(Options options) {
+    static constexpr Exec kExecs[2][2][2] = {
+        {{&VM::exec<false, false, false>, &VM::exec<false, false, true>},
+         {&VM::exec<false, true, false>, &VM::exec<false, true, true>}},
+        {{&VM::exec<true, false, false>, &VM::exec<true, false, true>},
+         {&VM::exec<true, true, false>, &VM::exec<true, true, true>}},
+    };
+    options_ = options;
+    bool trace = options.trace || options.trace_file;
+    exec_ = kExecs[trace][options.checked][bool(options.profile)];
 }
 
+// Hooks pop through here, so unlike Pop in the dispatch loop this is always
+// checked.
 uint16_t VM::pop() {
     if (stack_.empty()) throw std::out_of_range("stack empty");
-    auto val = stack_.back();
-    stack_.pop_back();
-    return val;
+    return stack_pop();
 }
 
-VM::Instr VM::load() {
-    auto op = to_opcode(memget(pc_));
-    return {op, memget(pc_ + 1), memget(pc_ + 2), memget(pc_ + 3)};
-}
-
-void disasm(const std::vector<uint16_t>& prog) {
-    for (int pc = 0; pc < prog.size();) {
-        auto x = prog[pc];
-        if (!is_opcode(x)) {
-            printf("[%8u] %u\n", pc, x);
-            pc++;
-            continue;
+VM::Decoded VM::decode(uint16_t pc) const {
+    auto op = to_opcode(memget(pc));
+    Decoded d{static_cast<uint8_t>(op), {0, 0, 0}};
+    for (int i = 0; i < arity(op); i++) {
+        uint16_t val = memget(pc + 1 + i);
+        if (val >= kMaxInt + kNumReg) {
+            throw std::invalid_argument("invalid number: " +
+                                        std::to_string(val));
         }
-        auto op = to_opcode(x);
-        int n = arity(op);
-        printf("[%8u] %s", pc, to_string(op));
-        if (n > 0) printf(" %s", value_string(prog[pc + 1]).c_str());
-        if (n > 1) printf(" %s", value_string(prog[pc + 2]).c_str());
-        if (n > 2) printf(" %s", value_string(prog[pc + 3]).c_str());
-        printf("\n");
-        pc += n + 1;
+        d.args[i] = val;
+    }
+    if (writes_first_arg(op) && d.args[0] < kMaxInt) {
+        throw std::invalid_argument("invalid register: " +
+                                    std::to_string(d.args[0]));
     }
+    return d;
 }
 
-void VM::exec(Instr instr) {
-    const auto& [op, a, b, c] = instr;
-    if (trace()) {
-        int n = arity(op);
-        fprintf(stderr, "[%8u] %s", pc_, to_string(op));
-        if (n > 0) fprintf(stderr, " %s", value_string(a).c_str());
-        if (n > 1) fprintf(stderr, " %s", value_string(b).c_str());
-        if (n > 2) fprintf(stderr, " %s", value_string(c).c_str());
-        fprintf(stderr, "\n");
+void VM::invalidate(uint16_t addr) {
+    // the longest instruction is four words, so a write can only change
+    // instructions starting up to three words before it
+    for (int i = 0; i < 4; i++) {
+        uint16_t pc = (addr - i) & kAddrMask;
+        if (slot(pc).op != kUndecoded) mut_slot(pc).op = kUndecoded;
     }
-    auto next_pc = pc_ + arity(op) + 1;
-    switch (op) {
-        case Opcode::Halt: {
-            state_ = State::Halt;
-            break;
-        }
-
-        case Opcode::Set: {
-            set(a, get(b));
-            break;
-        }
-
-        case Opcode::Push: {
-            stack_.push_back(get(a));
-            break;
-        }
-
-        case Opcode::Pop: {
-            set(a, pop());
-            break;
-        }
-
-        case Opcode::Eq: {
-            set(a, get(b) == get(c));
-            break;
-        }
+}
 
-        case Opcode::Gt: {
-            set(a, get(b) > get(c));
-            break;
+const std::array<uint64_t, 2 * kMaxInt> VM::kHashKeys = [] {
+    std::array<uint64_t, 2 * kMaxInt> keys;
+    // splitmix64
+    uint64_t x = 0;
+    for (auto& key : keys) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        key = z ^ (z >> 31);
+    }
+    return keys;
+}();
+
+void VM::rehash() {
+    mem_hash_ = 0;
+    for (size_t page = 0; page < kPages; page++) {
+        for (size_t i = 0; i < kPageSize; i++) {
+            mem_hash_ += kHashKeys[page * kPageSize + i] * (*mem_[page])[i];
         }
+    }
+    stack_hash_ = 0;
+    for (size_t i = 0; i < stack_.size(); i++) {
+        stack_hash_ += stack_key(i) * stack_[i];
+    }
+}
 
-        case Opcode::Jmp: {
-            next_pc = get(a);
-            break;
-        }
+uint64_t VM::state_hash() const {
+    // FNV-1a over the running sums and the rest of the state
+    static constexpr uint64_t kPrime = 0x100000001b3;
+    uint64_t h = 0xcbf29ce484222325;
+    auto mix = [&](uint64_t val) { h = (h ^ val) * kPrime; };
+    mix(mem_hash_);
+    mix(stack_hash_);
+    for (auto reg : regs_) mix(reg);
+    mix(stack_.size());
+    mix(pc_);
+    mix(static_cast<uint64_t>(state_));
+    for (size_t i = in_pos_; i < in_.size(); i++) mix(in_[i]);
+    return h;
+}
 
-        case Opcode::Jt: {
-            auto cond = get(a);
-            if (cond != 0) next_pc = get(b);
-            break;
-        }
+void VM::set_hook(uint16_t addr, Hook hook) {
+    addr &= kAddrMask;
+    hooks_[addr] = std::move(hook);
+    mut_slot(addr).op = kUndecoded;
+}
 
-        case Opcode::Jf: {
-            auto cond = get(a);
-            if (cond == 0) next_pc = get(b);
-            break;
-        }
+void VM::clear_hook(uint16_t addr) {
+    addr &= kAddrMask;
+    hooks_.erase(addr);
+    mut_slot(addr).op = kUndecoded;
+}
 
-        case Opcode::Add: {
-            auto result = (get(b) + get(c)) % kMaxInt;
-            set(a, result);
-            break;
-        }
+// Same text as value_string, without building a string per operand.
+static void print_value(FILE* out, uint16_t val) {
+    if (val < kMaxInt) {
+        fprintf(out, " %u", val);
+    } else if (val < kMaxInt + kNumReg) {
+        fprintf(out, " r%u", val - kMaxInt);
+    } else {
+        throw std::invalid_argument("invalid number: " + std::to_string(val));
+    }
+}
 
-        case Opcode::Mult: {
-            auto result = (get(b) * get(c)) % kMaxInt;
-            set(a, result);
-            break;
-        }
+void print_instr(FILE* out, uint16_t pc, const uint16_t* words) {
+    auto op = to_opcode(words[0]);
+    fprintf(out, "[%8u] %s", pc, to_string(op));
+    for (int i = 0; i < arity(op); i++) print_value(out, words[i + 1]);
+    putc('\n', out);
+}
 
-        case Opcode::Mod: {
-            auto result = (get(b) % get(c)) % kMaxInt;
-            set(a, result);
-            break;
-        }
+void append_number(std::string& out, unsigned val, size_t width) {
+    char buf[16];
+    auto end = std::to_chars(buf, buf + sizeof(buf), val).ptr;
+    size_t n = end - buf;
+    if (n < width) out.append(width - n, ' ');
+    out.append(buf, n);
+}
 
-        case Opcode::And: {
-            auto result = (get(b) & get(c));
-            set(a, result);
-            break;
+void append_instr(std::string& out, uint16_t pc, const uint16_t* words) {
+    auto op = to_opcode(words[0]);
+    out += '[';
+    append_number(out, pc, 8);
+    out += "] ";
+    out += to_string(op);
+    for (int i = 0; i < arity(op); i++) {
+        uint16_t val = words[i + 1];
+        if (val < kMaxInt) {
+            out += ' ';
+        } else if (val < kMaxInt + kNumReg) {
+            out += " r";
+            val -= kMaxInt;
+        } else {
+            throw std::invalid_argument("invalid number: " +
+                                        std::to_string(val));
         }
+        append_number(out, val);
+    }
+    out += '\n';
+}
 
-        case Opcode::Or: {
-            auto result = (get(b) | get(c));
-            set(a, result);
-            break;
-        }
+void disasm(const std::vector<uint16_t>& prog) {
+    // formatted in one buffer and written at once
+    std::string out;
+    out.reserve(prog.size() * 16);
+    disasm(prog, out);
+    write_all(STDOUT_FILENO, out);
+}
 
-        case Opcode::Not: {
-            auto result = (~get(b)) & (kMaxInt - 1);
-            set(a, result);
-            break;
+void disasm(const std::vector<uint16_t>& prog, std::string& out) {
+    for (size_t pc = 0; pc < prog.size();) {
+        auto x = prog[pc];
+        if (!is_opcode(x)) {
+            out += '[';
+            append_number(out, pc, 8);
+            out += "] ";
+            append_number(out, x);
+            out += '\n';
+            pc++;
+            continue;
         }
+        append_instr(out, pc, &prog[pc]);
+        pc += arity(to_opcode(x)) + 1;
+    }
+}
 
-        case Opcode::Rmem: {
-            set(a, memget(get(b)));
-            break;
-        }
+void VM::trace(uint16_t pc) const {
+    uint16_t words[4];
+    for (int i = 0; i < 4; i++) words[i] = memget(pc + i);
+    if (options_.trace_file) options_.trace_file->record(pc, words);
+    if (options_.trace) print_instr(stderr, pc, words);
+}
 
-        case Opcode::Wmem: {
-            memset(get(a), get(b));
-            break;
-        }
+// Executes up to |budget| instructions from the decoded cache, stopping
+// early on Halt and on In with an empty input queue. Without |out|, Out
+// also stops; otherwise the character is appended to |out|, stopping only
+// on a newline if |stop_on_newline|. Each handler jumps straight to the
+// next one (direct threading) instead of returning to a central switch.
+// |kTrace|, |kChecked| and |kProfile| compile in the instrumentation from
+// Options.
+template <bool kTrace, bool kChecked, bool kProfile>
+void VM::exec(uint64_t budget, std::string* out, bool stop_on_newline) {
+    static void* const kHandlers[] = {
+        &&op_halt, &&op_set,  &&op_push, &&op_pop,  &&op_eq,   &&op_gt,
+        &&op_jmp,  &&op_jt,   &&op_jf,   &&op_add,  &&op_mult, &&op_mod,
+        &&op_and,  &&op_or,   &&op_not,  &&op_rmem, &&op_wmem, &&op_call,
+        &&op_ret,  &&op_out,  &&op_in,   &&op_noop, &&op_decode, &&op_hook,
+    };
+
+    uint16_t pc = pc_;
+    const Decoded* d;
+    Profile* profile = options_.profile.get();
+
+#define A arg(d->args[0])
+#define B arg(d->args[1])
+#define C arg(d->args[2])
+#define SET_A(val) dst(d->args[0]) = (val)
+#define ADDR(val) to_addr<kChecked>(val)
+#define INSTRUMENT()                                            \
+    do {                                                        \
+        if (kTrace) trace(pc);                                  \
+        if (kProfile) profile->count(pc, d->op);                \
+    } while (0)
+#define DISPATCH()                                              \
+    do {                                                        \
+        if (budget-- == 0) goto done;                           \
+        d = &slot(pc);                                          \
+        if (d->op != kUndecoded) INSTRUMENT();                  \
+        goto* kHandlers[d->op];                                 \
+    } while (0)
+#define NEXT(n)              \
+    pc = ADDR(pc + (n) + 1); \
+    DISPATCH()
+
+    // an In that blocked on input was already counted when it first ran
+    bool resumed = state_ == State::In;
+    state_ = State::Run;
+    if (budget-- == 0) goto done;
+    d = &slot(pc);
+    if (d->op != kUndecoded && !resumed) INSTRUMENT();
+    goto* kHandlers[d->op];
+
+op_decode:
+    pc_ = pc;
+    {
+        // writing the slot can move its page to a private copy
+        auto& slot = mut_slot(pc);
+        slot = decode(pc);
+        if (hooks_.count(pc)) slot.op = kHooked;
+        d = &slot;
+    }
+    INSTRUMENT();
+    goto* kHandlers[d->op];
+
+op_hook:
+    pc_ = pc;
+    hooks_.at(pc)(*this);
+    pc = pc_;
+    DISPATCH();
+
+op_halt:
+    state_ = State::Halt;
+    pc = ADDR(pc + 1);
+    goto done;
+
+op_set:
+    SET_A(B);
+    NEXT(2);
+
+op_push:
+    stack_push(A);
+    NEXT(1);
+
+op_pop:
+    // one predictable branch keeps a malformed program from reading past
+    // the stack in every loop, not just the checked one
+    if (stack_.empty()) {
+        pc_ = pc;
+        throw std::out_of_range("stack empty");
+    }
+    SET_A(stack_pop());
+    NEXT(1);
 
-        case Opcode::Call: {
-            if (pc_ == 5489) {
-                reg_[0] = 6;
-                break;
-            }
-            stack_.push_back(next_pc);
-            next_pc = get(a);
-            break;
-        }
+op_eq:
+    SET_A(B == C);
+    NEXT(3);
 
-        case Opcode::Ret: {
-            if (stack_.empty()) {
-                state_ = State::Halt;
-                break;
-            }
-            next_pc = pop();
-            break;
-        }
+op_gt:
+    SET_A(B > C);
+    NEXT(3);
 
-        case Opcode::Out: {
-            state_ = State::Out;
-            out_ = get(a);
-            break;
-        }
+op_jmp:
+    pc = ADDR(A);
+    DISPATCH();
 
-        case Opcode::In: {
-            state_ = State::In;
-            next_pc = pc_;
-            break;
-        }
+op_jt:
+    if (A != 0) {
+        pc = ADDR(B);
+        DISPATCH();
+    }
+    NEXT(2);
 
-        case Opcode::Noop: {
-            break;
-        }
+op_jf:
+    if (A == 0) {
+        pc = ADDR(B);
+        DISPATCH();
+    }
+    NEXT(2);
+
+op_add:
+    SET_A((B + C) % kMaxInt);
+    NEXT(3);
+
+op_mult:
+    SET_A((B * C) % kMaxInt);
+    NEXT(3);
+
+op_mod:
+    if (kChecked && C == 0) throw std::domain_error("division by zero");
+    SET_A((B % C) % kMaxInt);
+    NEXT(3);
+
+op_and:
+    SET_A(B & C);
+    NEXT(3);
+
+op_or:
+    SET_A(B | C);
+    NEXT(3);
+
+op_not:
+    SET_A((~B) & (kMaxInt - 1));
+    NEXT(2);
+
+op_rmem:
+    SET_A(memget(ADDR(B)));
+    NEXT(2);
+
+op_wmem:
+    memset(ADDR(A), B);
+    NEXT(2);
+
+op_call:
+    if (kProfile) profile->call(pc, ADDR(A), stack_.size());
+    stack_push(pc + 2);
+    pc = ADDR(A);
+    DISPATCH();
+
+op_ret:
+    if (stack_.empty()) {
+        state_ = State::Halt;
+        pc = ADDR(pc + 1);
+        goto done;
+    }
+    if (kProfile) profile->ret(stack_.size());
+    pc = ADDR(stack_pop());
+    DISPATCH();
+
+op_out:
+    if (out == nullptr) {
+        state_ = State::Out;
+        out_ = A;
+        pc = ADDR(pc + 2);
+        goto done;
+    }
+    out->push_back(A);
+    if (stop_on_newline && A == '\n') {
+        pc = ADDR(pc + 2);
+        goto done;
+    }
+    NEXT(1);
+
+op_in:
+    if (in_pos_ == in_.size()) {
+        in_.clear();
+        in_pos_ = 0;
+        state_ = State::In;
+        goto done;
     }
-    pc_ = next_pc;
+    SET_A(static_cast<uint8_t>(in_[in_pos_++]));
+    NEXT(1);
+
+op_noop:
+    NEXT(0);
+
+#undef NEXT
+#undef DISPATCH
+#undef INSTRUMENT
+#undef ADDR
+#undef SET_A
+#undef C
+#undef B
+#undef A
+
+done:
+    pc_ = pc;
 }
 
 void VM::step() {
     if (state_ == State::Halt) return;
+    (this->*exec_)(1, nullptr, false);
+}
 
-    // handle previous input
-    if (state_ == State::In) {
-        const auto& [op, a, b, c] = load();
-        set(a, in_);
-        pc_ = pc_ + arity(Opcode::In) + 1;
-    }
-
-    state_ = State::Run;
-    exec(load());
+VM::State VM::run_until(Event event, std::string& out, uint64_t budget) {
+    if (state_ == State::Halt) return state_;
+    (this->*exec_)(budget, &out, event == Event::Line);
+    return state_;
 }
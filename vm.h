@@ -2,10 +2,20 @@
 #define VM_H_
 
 #include <array>
+#include <bitset>
 #include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <limits>
 #include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "cow.h"
+
 static constexpr uint16_t kMaxInt = (1 << 15);
 
 enum class Opcode : uint16_t {
@@ -35,7 +45,74 @@ enum class Opcode : uint16_t {
 
 static constexpr size_t kNumReg = 8;
 
+constexpr int arity(Opcode op) {
+    switch (op) {
+        case Opcode::Halt: return 0;
+        case Opcode::Set: return 2;
+        case Opcode::Push: return 1;
+        case Opcode::Pop: return 1;
+        case Opcode::Eq: return 3;
+        case Opcode::Gt: return 3;
+        case Opcode::Jmp: return 1;
+        case Opcode::Jt: return 2;
+        case Opcode::Jf: return 2;
+        case Opcode::Add: return 3;
+        case Opcode::Mult: return 3;
+        case Opcode::Mod: return 3;
+        case Opcode::And: return 3;
+        case Opcode::Or: return 3;
+        case Opcode::Not: return 2;
+        case Opcode::Rmem: return 2;
+        case Opcode::Wmem: return 2;
+        case Opcode::Call: return 1;
+        case Opcode::Ret: return 0;
+        case Opcode::Out: return 1;
+        case Opcode::In: return 1;
+        case Opcode::Noop: return 0;
+    }
+}
+
+// Whether the first operand of |op| is a register that it writes.
+constexpr bool writes_first_arg(Opcode op) {
+    switch (op) {
+        case Opcode::Set:
+        case Opcode::Pop:
+        case Opcode::Eq:
+        case Opcode::Gt:
+        case Opcode::Add:
+        case Opcode::Mult:
+        case Opcode::Mod:
+        case Opcode::And:
+        case Opcode::Or:
+        case Opcode::Not:
+        case Opcode::Rmem:
+        case Opcode::In: return true;
+        default: return false;
+    }
+}
+
+bool is_opcode(uint16_t val);
+const char* to_string(Opcode op);
+std::string value_string(uint16_t val);
+
+// Prints the instruction at |pc| as "[     pc] OP args", given the words
+// starting there.
+void print_instr(FILE* out, uint16_t pc, const uint16_t* words);
+// Appends the same text to |out|.
+void append_instr(std::string& out, uint16_t pc, const uint16_t* words);
+// Appends |val| right-aligned in |width| columns.
+void append_number(std::string& out, unsigned val, size_t width = 0);
+
+// Prints |prog| as instructions, with words that are not opcodes as data.
 void disasm(const std::vector<uint16_t>& prog);
+// Appends the same listing to |out|.
+void disasm(const std::vector<uint16_t>& prog, std::string& out);
+
+// Reads a program of little-endian words, as VM::load_program does.
+std::vector<uint16_t> read_program(const std::string& path);
+
+class Profile;
+class TraceWriter;
 
 class VM final {
 public:
@@ -46,37 +123,204 @@ public:
         In,
     };
 
-    VM(std::vector<uint16_t> program);
+    // Conditions that end a call to run_until, in addition to halting,
+    // running out of queued input and exhausting the instruction budget.
+    enum class Event {
+        Input,  // only the above
+        Line,   // also after writing a newline
+    };
+
+    static constexpr uint64_t kNoBudget = std::numeric_limits<uint64_t>::max();
+
+    // Instrumentation for the dispatch loop. Every combination is compiled
+    // as its own copy of the loop, picked when the options are set, so the
+    // ones that are off cost nothing. Hooks need no option: a hooked slot
+    // dispatches to its own handler.
+    struct Options {
+        bool trace = false;    // print each instruction to stderr
+        bool checked = false;  // throw on bad addresses and division by
+                               // zero instead of wrapping (empty-stack
+                               // pops throw either way)
+        std::shared_ptr<TraceWriter> trace_file;  // record each instruction
+        std::shared_ptr<Profile> profile;         // count each instruction
+    };
+
+    // A native replacement for the instruction at a hooked address. It runs
+    // instead of that instruction, with the VM's pc still pointing at it,
+    // and must leave pc wherever execution should continue. Hooking the
+    // entry of a routine replaces the routine, in which case the hook
+    // returns by popping the return address into pc.
+    using Hook = std::function<void(VM& vm)>;
+
+    VM(std::vector<uint16_t> program, Options options);
+    VM(std::vector<uint16_t> program) : VM(std::move(program), Options()) {}
     State state() const { return state_; }
+    const Options& options() const { return options_; }
+    void set_options(Options options);
+
+    // Executes a single instruction. Out leaves the VM in State::Out with
+    // the character in output(); In consumes a queued character or leaves
+    // the VM in State::In until more input is queued.
     void step();
     char output() const { return out_; }
-    void input(char ch) { in_ = ch; }
-    void set_reg(size_t reg, uint16_t val) { reg_[reg] = val; }
 
-private:
-    using Instr = std::tuple<Opcode, uint16_t, uint16_t, uint16_t>;
+    // Executes instructions until |event| or |budget| instructions have
+    // run. Output is appended to |out| without leaving the dispatch loop
+    // and In reads from the input queue. Returns State::Run if the budget
+    // ran out, State::In if the VM is blocked on input, or State::Halt.
+    State run_until(Event event, std::string& out, uint64_t budget = kNoBudget);
+    State run(std::string& out, uint64_t budget = kNoBudget) {
+        return run_until(Event::Input, out, budget);
+    }
 
-    Instr load();
-    void exec(Instr instr);
-    uint16_t get(uint16_t val) const;
-    void set(uint16_t loc, uint16_t val);
+    void input(char ch) { in_.push_back(ch); }
+    void input(std::string_view chars) { in_.append(chars); }
+    size_t pending_input() const { return in_.size() - in_pos_; }
+    uint16_t reg(size_t reg) const { return regs_[reg]; }
+    void set_reg(size_t reg, uint16_t val) { regs_[reg] = val; }
+    uint16_t pc() const { return pc_; }
+    void set_pc(uint16_t pc) { pc_ = pc & kAddrMask; }
+    const std::vector<uint16_t>& stack() const { return stack_; }
+    void push(uint16_t val) { stack_push(val); }
     uint16_t pop();
+    uint16_t peek(uint16_t addr) const { return memget(addr); }
+    void poke(uint16_t addr, uint16_t val) { memset(addr, val); }
+
+    // Returns a copy of the VM that shares memory pages with it until one
+    // of the two writes to them, which makes this O(pages) rather than
+    // O(memory). Forks can run on different threads, though options with a
+    // trace file or profile share that sink. Copying a VM forks it.
+    VM fork() const { return *this; }
+
+    // A hash of everything that determines how the VM runs from here:
+    // memory, registers, stack, pc, state and pending input. Memory and the
+    // stack keep running sums that every write updates, so this is O(1)
+    // (plus any pending input).
+    uint64_t state_hash() const;
 
-    uint16_t memget(uint16_t addr) {
-        return mem_.size() > addr ? mem_[addr] : 0;
+    // Memory is split into pages of 256 words. A page is dirty once written
+    // since the VM was created or loaded, or since clear_dirty_pages.
+    static constexpr size_t kPageWords = 256;
+    static constexpr size_t kPages = kMaxInt / kPageWords;
+    const std::bitset<kPages>& dirty_pages() const { return dirty_; }
+    void clear_dirty_pages() { dirty_.reset(); }
+
+    // Images hold the complete state (memory, registers, stack, pc, state
+    // and pending I/O) in a versioned binary layout that restores with a few
+    // copies out of a mapping, no parsing. Hooks and options are not part
+    // of the image. Both throw std::runtime_error on I/O errors, and
+    // load_image also if the file is not a valid image.
+    void save_image(const std::string& path) const;
+    static VM load_image(const std::string& path, Options options);
+    static bool is_image(const std::string& path);
+
+    // Programs are little-endian words, mapped and decoded straight into
+    // memory pages. Throws std::runtime_error if the file cannot be read,
+    // is too large or odd-sized, or holds a word above the registers.
+    static VM load_program(const std::string& path, Options options);
+
+    // Hooks cost nothing at addresses without one: a hooked address decodes
+    // to a dedicated handler instead of its instruction.
+    void set_hook(uint16_t addr, Hook hook);
+    void clear_hook(uint16_t addr);
+    bool hooked(uint16_t addr) const { return hooks_.count(addr) > 0; }
+
+private:
+    // An instruction decoded from memory. Operands keep their raw encoding,
+    // which decode() has checked to be a literal or a valid register.
+    struct Decoded {
+        uint8_t op;
+        uint16_t args[3];
+    };
+
+    // Marks a slot in code_ that must be decoded before it is executed.
+    static constexpr uint8_t kUndecoded =
+        static_cast<uint8_t>(Opcode::Noop) + 1;
+    // Marks a slot whose address has a hook.
+    static constexpr uint8_t kHooked = kUndecoded + 1;
+    static constexpr uint16_t kAddrMask = kMaxInt - 1;
+
+    // Memory and the decoded-instruction cache are split into pages that
+    // forks share until they write them.
+    static constexpr int kPageBits = 8;
+    static constexpr uint16_t kPageSize = 1 << kPageBits;
+    static constexpr uint16_t kPageMask = kPageSize - 1;
+    static_assert(kPageSize == kPageWords);
+    using MemPage = std::array<uint16_t, kPageSize>;
+    using CodePage = std::array<Decoded, kPageSize>;
+
+    Decoded decode(uint16_t pc) const;
+    void invalidate(uint16_t addr);
+    template <bool kTrace, bool kChecked, bool kProfile>
+    void exec(uint64_t budget, std::string* out, bool stop_on_newline);
+    using Exec = void (VM::*)(uint64_t budget, std::string* out,
+                              bool stop_on_newline);
+    void trace(uint16_t pc) const;
+
+    // Register operands are 32768-32775, so the low bits index regs_ and
+    // an operand is read with one load and a select instead of a branch.
+    uint16_t arg(uint16_t raw) const {
+        uint16_t val = regs_[raw & (kNumReg - 1)];
+        return raw >= kMaxInt ? val : raw;
+    }
+    uint16_t& dst(uint16_t raw) { return regs_[raw & (kNumReg - 1)]; }
+
+    const Decoded& slot(uint16_t pc) const {
+        return (*code_[pc >> kPageBits])[pc & kPageMask];
+    }
+    Decoded& mut_slot(uint16_t pc) {
+        return code_[pc >> kPageBits].mut()[pc & kPageMask];
+    }
+
+    uint16_t memget(uint16_t addr) const {
+        addr &= kAddrMask;
+        return (*mem_[addr >> kPageBits])[addr & kPageMask];
     }
     void memset(uint16_t addr, uint16_t val) {
-        if (addr >= mem_.size()) mem_.resize(2 * static_cast<size_t>(addr) + 1);
-        mem_[addr] = val;
+        addr &= kAddrMask;
+        auto& word = mem_[addr >> kPageBits].mut()[addr & kPageMask];
+        mem_hash_ += kHashKeys[addr] * (uint64_t(val) - word);
+        word = val;
+        dirty_.set(addr >> kPageBits);
+        invalidate(addr);
+    }
+
+    // The state hash sums each word times a random key for its position,
+    // so a write adds key * (new - old). Stack slots take the keys after
+    // memory's.
+    static const std::array<uint64_t, 2 * kMaxInt> kHashKeys;
+    static uint64_t stack_key(size_t depth) {
+        return kHashKeys[kMaxInt + (depth & kAddrMask)];
+    }
+    void stack_push(uint16_t val) {
+        stack_hash_ += stack_key(stack_.size()) * val;
+        stack_.push_back(val);
+    }
+    // Callers check for an empty stack first.
+    uint16_t stack_pop() {
+        uint16_t val = stack_.back();
+        stack_.pop_back();
+        stack_hash_ -= stack_key(stack_.size()) * val;
+        return val;
     }
+    // Recomputes the running sums after memory or the stack was replaced.
+    void rehash();
 
     uint16_t pc_ = 0;
     char out_ = 0;
-    char in_ = 0;
-    std::vector<uint16_t> mem_;
+    std::string in_;
+    size_t in_pos_ = 0;
+    std::array<uint16_t, kNumReg> regs_{};
+    std::array<Cow<MemPage>, kPages> mem_;
     std::vector<uint16_t> stack_;
-    std::array<uint16_t, kNumReg> reg_;
+    uint64_t mem_hash_ = 0;
+    uint64_t stack_hash_ = 0;
+    std::bitset<kPages> dirty_;
+    std::array<Cow<CodePage>, kPages> code_;
+    std::map<uint16_t, Hook> hooks_;
     State state_ = State::Run;
+    Options options_;
+    Exec exec_;
 };
 
 #endif  // VM_H_